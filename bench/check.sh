@@ -0,0 +1,116 @@
+#!/bin/sh
+# Controllo differenziale di plan-route: genera i carichi di workload.c e confronta
+# con le risposte di dijkstra, il motore di partenza, quelle di ogni altro motore, di
+# --verify-engine, di --pipeline, di --threads e del server (--server, tramite
+# loadgen.c); poi quelle di pianifica-percorsi con gli stessi arrivi chiesti uno
+# per volta.
+#
+#   gcc -O2 -pthread plan-route.c -o plan-route
+#   sh bench/check.sh ./plan-route
+#
+# Variabili: STATIONS, OPS e SEEDS per la dimensione e il numero dei carichi.
+# Esce con 1 alla prima differenza, lasciando i file nella cartella temporanea.
+
+set -e
+
+BIN=${1:-./plan-route}
+STATIONS=${STATIONS:-2000}
+OPS=${OPS:-10000}
+SEEDS=${SEEDS:-"1 2 3"}
+BENCH=$(dirname "$0")
+TMP=$(mktemp -d)
+
+gcc -O2 "$BENCH/workload.c" -o "$TMP/workload"
+gcc -O2 -pthread "$BENCH/loadgen.c" -o "$TMP/loadgen"
+
+# Confronta le risposte di $BIN con gli argomenti dati con quelle di riferimento.
+# Anche un'uscita con errore, per esempio un disaccordo di --verify-engine, ferma
+# il controllo.
+compare() {
+    name=$1
+    input=$2
+    reference=$3
+    shift 3
+    if ! "$BIN" "$@" < "$input" > "$TMP/out.txt" 2> "$TMP/err.txt"; then
+        echo "ERRORE: $name $* (carico $input, messaggi in $TMP/err.txt)"
+        exit 1
+    fi
+    if ! cmp -s "$reference" "$TMP/out.txt"; then
+        echo "DIVERSO: $name $* (carico $input, risposte in $TMP)"
+        exit 1
+    fi
+}
+
+# Come compare, con i comandi inviati al server su una sola connessione
+compare_server() {
+    name=$1
+    input=$2
+    reference=$3
+    shift 3
+    socket="$TMP/plan-route.sock"
+    "$BIN" --server "$socket" "$@" < /dev/null 2> "$TMP/err.txt" &
+    server=$!
+    while [ ! -S "$socket" ]; do
+        if ! kill -0 $server 2> /dev/null; then
+            echo "ERRORE: $name --server $* (messaggi in $TMP/err.txt)"
+            exit 1
+        fi
+        sleep 0.05
+    done
+    "$TMP/loadgen" --socket "$socket" --clients 1 --depth 64 --replies "$TMP/out.txt" \
+        --output /dev/null "$input" 2> /dev/null
+    kill -INT $server
+    wait $server
+    if ! cmp -s "$reference" "$TMP/out.txt"; then
+        echo "DIVERSO: $name --server $* (carico $input, risposte in $TMP)"
+        exit 1
+    fi
+}
+
+# Ogni pianifica-percorso P A diventa un pianifica-percorsi con arrivi A, due stazioni
+# aggiunte di recente e P stessa, e in expanded.txt gli stessi arrivi uno per comando
+expand() {
+    awk -v fan="$TMP/fan.txt" -v expanded="$TMP/expanded.txt" '
+        $1 == "aggiungi-stazione" { recent[added++ % 64] = $2 }
+        $1 == "pianifica-percorso" && added > 0 {
+            a = recent[NR % (added < 64 ? added : 64)]
+            b = recent[(NR * 7) % (added < 64 ? added : 64)]
+            print "pianifica-percorsi", $2, 4, $3, a, b, $2 > fan
+            print "pianifica-percorso", $2, $3 > expanded
+            print "pianifica-percorso", $2, a > expanded
+            print "pianifica-percorso", $2, b > expanded
+            print "pianifica-percorso", $2, $2 > expanded
+            next
+        }
+        { print > fan; print > expanded }
+    '
+}
+
+for mix in random sorted dense sparse queries mutations; do
+    for seed in $SEEDS; do
+        input="$TMP/$mix-$seed.txt"
+        "$TMP/workload" --mix $mix --stations "$STATIONS" --ops "$OPS" --seed "$seed" > "$input"
+
+        "$BIN" --engine dijkstra < "$input" > "$TMP/reference.txt"
+        for engine in sweep soa bidirectional jump reach; do
+            compare "$mix/$seed" "$input" "$TMP/reference.txt" --engine $engine
+        done
+        compare "$mix/$seed" "$input" "$TMP/reference.txt" --verify-engine dijkstra
+        compare "$mix/$seed" "$input" "$TMP/reference.txt" --engine soa --verify-engine jump
+        compare "$mix/$seed" "$input" "$TMP/reference.txt" --pipeline
+        compare "$mix/$seed" "$input" "$TMP/reference.txt" --threads 4
+        compare_server "$mix/$seed" "$input" "$TMP/reference.txt"
+        compare_server "$mix/$seed" "$input" "$TMP/reference.txt" --engine bidirectional
+
+        expand < "$input"
+        "$BIN" --engine dijkstra < "$TMP/expanded.txt" > "$TMP/reference.txt"
+        compare "$mix/$seed" "$TMP/fan.txt" "$TMP/reference.txt"
+        compare "$mix/$seed" "$TMP/fan.txt" "$TMP/reference.txt" --pipeline
+        compare "$mix/$seed" "$TMP/fan.txt" "$TMP/reference.txt" --soa
+        compare "$mix/$seed" "$TMP/fan.txt" "$TMP/reference.txt" --verify-engine dijkstra
+        compare_server "$mix/$seed" "$TMP/fan.txt" "$TMP/reference.txt"
+        echo "ok $mix/$seed"
+    done
+done
+
+rm -rf "$TMP"
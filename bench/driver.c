@@ -0,0 +1,322 @@
+// Driver dei benchmark: esegue plan-route su uno o più carichi generati da
+// workload.c e scrive i risultati in JSON, così due esecuzioni si possono confrontare.
+//
+//   gcc -O2 bench/driver.c -o driver
+//   ./driver --bin ./plan-route --output risultati.json random.txt queries.txt -- --threads 4
+//
+// Per ogni carico si fanno due esecuzioni:
+//   - throughput: l'intero file su stdin, misurando tempo totale e picco di RSS;
+//   - latenza: i comandi vengono inviati su una pipe e ogni --sample-esimo comando
+//     viene cronometrato da solo, dopo aver ricevuto le risposte dei precedenti.
+// Gli argomenti dopo -- vengono passati a plan-route.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "workload_io.h"
+
+#define MAX_SAMPLES_DEFAULT 100000
+
+// Latenze misurate per un tipo di comando, in nanosecondi
+typedef struct LatencySamples {
+    long commands;
+    long* values;
+    long size;
+    long capacity;
+} LatencySamples;
+
+typedef struct ChildProcess {
+    pid_t pid;
+    int input;   // Scrittura verso lo stdin di plan-route
+    int output;  // Lettura dallo stdout di plan-route
+} ChildProcess;
+
+pid_t spawn(char** argv, int stdin_fd, int stdout_fd) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        dup2(stdin_fd, STDIN_FILENO);
+        dup2(stdout_fd, STDOUT_FILENO);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    return pid;
+}
+
+// Esecuzione di throughput: restituisce il tempo totale, il picco di RSS in KB
+double run_throughput(char** argv, const char* path, long* peak_rss_kb) {
+    int input = open(path, O_RDONLY);
+    int null_output = open("/dev/null", O_WRONLY);
+    if (input < 0 || null_output < 0) {
+        fprintf(stderr, "Impossibile aprire %s\n", path);
+        exit(1);
+    }
+
+    double start = now_seconds();
+    pid_t pid = spawn(argv, input, null_output);
+    close(input);
+    close(null_output);
+
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            perror("wait4");
+            exit(1);
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s: plan-route è terminato in modo anomalo\n", path);
+        exit(1);
+    }
+    *peak_rss_kb = usage.ru_maxrss;
+    return elapsed;
+}
+
+void start_child(ChildProcess* child, char** argv) {
+    // Con O_CLOEXEC il figlio non eredita le estremità del driver, altrimenti
+    // il suo stdin non arriverebbe mai a fine file
+    int to_child[2], from_child[2];
+    if (pipe2(to_child, O_CLOEXEC) < 0 || pipe2(from_child, O_CLOEXEC) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    child->pid = spawn(argv, to_child[0], from_child[1]);
+    close(to_child[0]);
+    close(from_child[1]);
+    child->input = to_child[1];
+    child->output = from_child[0];
+}
+
+// Scrive i comandi e legge finché non sono arrivate tutte le righe attese.
+// Lettura e scrittura si alternano per non bloccarsi su una pipe piena.
+void exchange(ChildProcess* child, const char* data, size_t length, long replies) {
+    char buffer[1 << 16];
+    size_t written = 0;
+
+    while (written < length || replies > 0) {
+        struct pollfd fds[2];
+        int nfds = 0;
+        fds[nfds].fd = child->output;
+        fds[nfds].events = POLLIN;
+        nfds++;
+        if (written < length) {
+            fds[nfds].fd = child->input;
+            fds[nfds].events = POLLOUT;
+            nfds++;
+        }
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            exit(1);
+        }
+
+        if (nfds == 2 && (fds[1].revents & (POLLOUT | POLLERR | POLLHUP))) {
+            ssize_t n = write(child->input, data + written, length - written);
+            if (n < 0 && errno != EINTR && errno != EAGAIN) {
+                fprintf(stderr, "plan-route ha chiuso l'input\n");
+                exit(1);
+            }
+            if (n > 0) {
+                written += n;
+            }
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = read(child->output, buffer, sizeof(buffer));
+            if (n == 0) {
+                fprintf(stderr, "plan-route è terminato prima di rispondere\n");
+                exit(1);
+            }
+            for (ssize_t i = 0; i < n; i++) {
+                if (buffer[i] == '\n') {
+                    replies--;
+                }
+            }
+        }
+    }
+}
+
+void add_sample(LatencySamples* samples, long value) {
+    if (samples->size == samples->capacity) {
+        samples->capacity = samples->capacity > 0 ? samples->capacity * 2 : 1024;
+        samples->values = (long*)realloc(samples->values, samples->capacity * sizeof(long));
+        if (samples->values == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    samples->values[samples->size++] = value;
+}
+
+void run_latency(char** argv, Workload* w, long sample, LatencySamples samples[KIND_COUNT]) {
+    ChildProcess child;
+    start_child(&child, argv);
+
+    long pending_from = 0;  // Primo comando inviato senza cronometro
+    long pending_replies = 0;
+    for (long i = 0; i < w->count; i++) {
+        samples[w->kind[i]].commands++;
+        if (i % sample != 0) {
+            pending_replies += w->replies[i];
+            continue;
+        }
+
+        if (pending_from < i) {
+            exchange(&child, w->data + w->line_start[pending_from], w->line_start[i] - w->line_start[pending_from], pending_replies);
+        }
+        long start = now_nanoseconds();
+        exchange(&child, w->data + w->line_start[i], w->line_start[i + 1] - w->line_start[i], w->replies[i]);
+        add_sample(&samples[w->kind[i]], now_nanoseconds() - start);
+
+        pending_from = i + 1;
+        pending_replies = 0;
+    }
+    if (pending_from < w->count) {
+        exchange(&child, w->data + w->line_start[pending_from], w->length - w->line_start[pending_from], pending_replies);
+    }
+
+    close(child.input);
+    close(child.output);
+    int status;
+    waitpid(child.pid, &status, 0);
+}
+
+int compare_long(const void* a, const void* b) {
+    long x = *(const long*)a, y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+double percentile_us(LatencySamples* samples, double p) {
+    long index = (long)(p * (samples->size - 1) + 0.5);
+    return samples->values[index] / 1000.0;
+}
+
+void print_usage(const char* program) {
+    fprintf(stderr, "uso: %s [--bin plan-route] [--sample n] [--output file.json] carico... [-- argomenti]\n", program);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    const char* binary = "./plan-route";
+    const char* output_path = NULL;
+    long sample = 0;
+    char** workloads = (char**)malloc(argc * sizeof(char*));
+    int num_workloads = 0;
+    char** child_argv = (char**)malloc((argc + 2) * sizeof(char*));
+    int child_argc = 1;
+
+    int i = 1;
+    for (; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(argv[i], "--bin") == 0 && i + 1 < argc) {
+            binary = argv[++i];
+        } else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+            sample = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            print_usage(argv[0]);
+        } else {
+            workloads[num_workloads++] = argv[i];
+        }
+    }
+    for (; i < argc; i++) {
+        child_argv[child_argc++] = argv[i];
+    }
+    child_argv[0] = (char*)binary;
+    child_argv[child_argc] = NULL;
+    if (num_workloads == 0) {
+        print_usage(argv[0]);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    FILE* json = stdout;
+    if (output_path != NULL && (json = fopen(output_path, "w")) == NULL) {
+        fprintf(stderr, "Impossibile scrivere %s\n", output_path);
+        return 1;
+    }
+
+    fprintf(json, "{\n  \"binary\": \"%s\",\n  \"args\": [", binary);
+    for (int a = 1; a < child_argc; a++) {
+        fprintf(json, "%s\"%s\"", a > 1 ? ", " : "", child_argv[a]);
+    }
+    fprintf(json, "],\n  \"workloads\": [\n");
+
+    for (int n = 0; n < num_workloads; n++) {
+        Workload w;
+        load_workload(&w, workloads[n]);
+
+        long peak_rss_kb;
+        double wall = run_throughput(child_argv, workloads[n], &peak_rss_kb);
+
+        long every = sample > 0 ? sample : (w.count + MAX_SAMPLES_DEFAULT - 1) / MAX_SAMPLES_DEFAULT;
+        if (every < 1) {
+            every = 1;
+        }
+        LatencySamples samples[KIND_COUNT];
+        memset(samples, 0, sizeof(samples));
+        run_latency(child_argv, &w, every, samples);
+
+        fprintf(stderr, "%s: %ld comandi in %.3f s (%.0f comandi/s), picco RSS %ld KB\n",
+                workloads[n], w.count, wall, w.count / wall, peak_rss_kb);
+
+        fprintf(json, "    {\n      \"file\": \"%s\",\n      \"commands\": %ld,\n", workloads[n], w.count);
+        fprintf(json, "      \"wall_seconds\": %.6f,\n      \"commands_per_second\": %.1f,\n", wall, w.count / wall);
+        fprintf(json, "      \"peak_rss_kb\": %ld,\n      \"sample_every\": %ld,\n", peak_rss_kb, every);
+        fprintf(json, "      \"latency\": {");
+        bool first = true;
+        for (int k = 0; k < KIND_COUNT; k++) {
+            LatencySamples* s = &samples[k];
+            if (s->size == 0) {
+                continue;
+            }
+            qsort(s->values, s->size, sizeof(long), compare_long);
+            double total = 0;
+            for (long v = 0; v < s->size; v++) {
+                total += s->values[v];
+            }
+            double mean_us = total / s->size / 1000.0;
+
+            fprintf(json, "%s\n        \"%s\": { \"commands\": %ld, \"samples\": %ld, ", first ? "" : ",", kind_names[k], s->commands, s->size);
+            fprintf(json, "\"mean_us\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f, \"per_second\": %.1f }",
+                    mean_us, percentile_us(s, 0.50), percentile_us(s, 0.99), s->values[s->size - 1] / 1000.0, 1e6 / mean_us);
+            first = false;
+
+            fprintf(stderr, "  %-20s p50 %9.2f us  p99 %9.2f us  (%ld campioni)\n", kind_names[k], percentile_us(s, 0.50), percentile_us(s, 0.99), s->size);
+            free(s->values);
+        }
+        fprintf(json, "\n      }\n    }%s\n", n + 1 < num_workloads ? "," : "");
+        free_workload(&w);
+    }
+
+    fprintf(json, "  ]\n}\n");
+    if (json != stdout) {
+        fclose(json);
+    }
+    free(workloads);
+    free(child_argv);
+    return 0;
+}
@@ -0,0 +1,316 @@
+// Generatore di carico per plan-route in modalità server (--server): misura il
+// throughput di più connessioni insieme e scrive i risultati in JSON come driver.c.
+//
+//   gcc -O2 -pthread bench/loadgen.c -o loadgen
+//   ./plan-route --server /tmp/plan-route.sock &
+//   ./loadgen --socket /tmp/plan-route.sock --clients 8 --depth 16 queries.txt
+//
+// Gli aggiungi-stazione iniziali del carico costruiscono la rete su una sola
+// connessione. I comandi successivi vengono divisi a turno tra --clients
+// connessioni, che partono insieme e tengono in volo gruppi di --depth comandi:
+// ogni gruppo viene cronometrato dall'invio all'ultima risposta.
+// Con --clients 1, --replies file salva le risposte nell'ordine del carico, per
+// confrontarle con quelle di stdin (bench/check.sh).
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "workload_io.h"
+
+#define SETUP_GROUP 4096  // Comandi per gruppo nella fase di costruzione
+
+// Una connessione con i suoi comandi, copiati di seguito in un buffer
+typedef struct Connection {
+    const char* socket_path;
+    pthread_barrier_t* start;
+    Workload* w;
+    long first;       // Primo comando del carico
+    long step;        // Distanza tra due comandi della connessione
+    long end;
+    long depth;
+    long commands;
+    long queries;
+    long* latencies;  // Nanosecondi per gruppo
+    long groups;
+    FILE* replies;    // Dove copiare le risposte, NULL per scartarle
+} Connection;
+
+int connect_server(const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Percorso del socket troppo lungo: %s\n", path);
+        exit(1);
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "Impossibile connettersi a %s\n", path);
+        exit(1);
+    }
+    return fd;
+}
+
+// Scrive i comandi e legge finché non sono arrivate tutte le righe attese.
+// Lettura e scrittura si alternano per non bloccarsi su un socket pieno.
+void exchange(int fd, const char* data, size_t length, long replies, FILE* copy) {
+    char buffer[1 << 16];
+    size_t written = 0;
+
+    while (written < length || replies > 0) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN | (written < length ? POLLOUT : 0);
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            exit(1);
+        }
+
+        if (written < length && (pfd.revents & POLLOUT)) {
+            ssize_t n = send(fd, data + written, length - written, MSG_DONTWAIT);
+            if (n < 0 && errno != EINTR && errno != EAGAIN) {
+                fprintf(stderr, "Il server ha chiuso la connessione\n");
+                exit(1);
+            }
+            if (n > 0) {
+                written += n;
+            }
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+                fprintf(stderr, "Il server è terminato prima di rispondere\n");
+                exit(1);
+            }
+            for (ssize_t i = 0; i < n; i++) {
+                if (buffer[i] == '\n') {
+                    replies--;
+                }
+            }
+            if (copy != NULL && n > 0) {
+                fwrite(buffer, 1, n, copy);
+            }
+        }
+    }
+}
+
+void* connection_main(void* arg) {
+    Connection* c = (Connection*)arg;
+    Workload* w = c->w;
+    int fd = connect_server(c->socket_path);
+
+    // I comandi della connessione non sono contigui nel carico: si copiano prima
+    // della partenza, insieme alle fini dei gruppi
+    size_t length = 0;
+    for (long i = c->first; i < c->end; i += c->step) {
+        length += w->line_start[i + 1] - w->line_start[i];
+        c->commands++;
+    }
+    char* data = (char*)malloc(length + 1);
+    long groups = (c->commands + c->depth - 1) / c->depth;
+    size_t* group_end = (size_t*)malloc((groups + 1) * sizeof(size_t));
+    long* group_replies = (long*)calloc(groups + 1, sizeof(long));
+    c->latencies = (long*)malloc((groups + 1) * sizeof(long));
+    if (data == NULL || group_end == NULL || group_replies == NULL || c->latencies == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    length = 0;
+    long n = 0;
+    for (long i = c->first; i < c->end; i += c->step, n++) {
+        size_t size = w->line_start[i + 1] - w->line_start[i];
+        memcpy(data + length, w->data + w->line_start[i], size);
+        length += size;
+        group_end[n / c->depth] = length;
+        group_replies[n / c->depth] += w->replies[i];
+        c->queries += w->kind[i] == KIND_PIANIFICA_PERCORSO || w->kind[i] == KIND_PIANIFICA_PERCORSI;
+    }
+
+    if (c->start != NULL) {
+        pthread_barrier_wait(c->start);
+    }
+    size_t begin = 0;
+    for (long g = 0; g < groups; g++) {
+        long start = now_nanoseconds();
+        exchange(fd, data + begin, group_end[g] - begin, group_replies[g], c->replies);
+        c->latencies[g] = now_nanoseconds() - start;
+        begin = group_end[g];
+    }
+    c->groups = groups;
+
+    close(fd);
+    free(data);
+    free(group_end);
+    free(group_replies);
+    return NULL;
+}
+
+int compare_long(const void* a, const void* b) {
+    long x = *(const long*)a, y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+void print_usage(const char* program) {
+    fprintf(stderr, "uso: %s --socket percorso [--clients n] [--depth n] [--output file.json] [--replies file] carico\n", program);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    const char* socket_path = NULL;
+    const char* output_path = NULL;
+    const char* workload_path = NULL;
+    const char* replies_path = NULL;
+    long clients = 4;
+    long depth = 16;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+            clients = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            depth = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "--replies") == 0 && i + 1 < argc) {
+            replies_path = argv[++i];
+        } else if (argv[i][0] == '-' || workload_path != NULL) {
+            print_usage(argv[0]);
+        } else {
+            workload_path = argv[i];
+        }
+    }
+    if (socket_path == NULL || workload_path == NULL || clients < 1 || depth < 1) {
+        print_usage(argv[0]);
+    }
+    // Le risposte di più connessioni si mescolerebbero: solo una, nell'ordine del carico
+    if (replies_path != NULL && clients != 1) {
+        fprintf(stderr, "--replies richiede --clients 1\n");
+        return 1;
+    }
+    FILE* replies = NULL;
+    if (replies_path != NULL && (replies = fopen(replies_path, "w")) == NULL) {
+        fprintf(stderr, "Impossibile scrivere %s\n", replies_path);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    Workload w;
+    load_workload(&w, workload_path);
+    long setup = 0;
+    while (setup < w.count && w.kind[setup] == KIND_AGGIUNGI_STAZIONE) {
+        setup++;
+    }
+
+    Connection builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.socket_path = socket_path;
+    builder.w = &w;
+    builder.step = 1;
+    builder.end = setup;
+    builder.depth = SETUP_GROUP;
+    builder.replies = replies;
+    double setup_start = now_seconds();
+    connection_main(&builder);
+    double setup_seconds = now_seconds() - setup_start;
+    free(builder.latencies);
+
+    Connection* connections = (Connection*)calloc(clients, sizeof(Connection));
+    pthread_t* threads = (pthread_t*)malloc(clients * sizeof(pthread_t));
+    if (connections == NULL || threads == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    // Il cronometro parte quando tutte le connessioni sono pronte
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, (unsigned)clients + 1);
+    for (long c = 0; c < clients; c++) {
+        connections[c].socket_path = socket_path;
+        connections[c].start = &start;
+        connections[c].w = &w;
+        connections[c].first = setup + c;
+        connections[c].step = clients;
+        connections[c].end = w.count;
+        connections[c].depth = depth;
+        connections[c].replies = replies;
+        if (pthread_create(&threads[c], NULL, connection_main, &connections[c]) != 0) {
+            fprintf(stderr, "Impossibile avviare la connessione %ld\n", c);
+            return 1;
+        }
+    }
+    pthread_barrier_wait(&start);
+    double run_start = now_seconds();
+    for (long c = 0; c < clients; c++) {
+        pthread_join(threads[c], NULL);
+    }
+    double wall = now_seconds() - run_start;
+    pthread_barrier_destroy(&start);
+    if (replies != NULL) {
+        fclose(replies);
+    }
+
+    long commands = 0, queries = 0, groups = 0;
+    for (long c = 0; c < clients; c++) {
+        commands += connections[c].commands;
+        queries += connections[c].queries;
+        groups += connections[c].groups;
+    }
+    long* latencies = (long*)malloc((groups + 1) * sizeof(long));
+    if (latencies == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    groups = 0;
+    for (long c = 0; c < clients; c++) {
+        memcpy(latencies + groups, connections[c].latencies, connections[c].groups * sizeof(long));
+        groups += connections[c].groups;
+        free(connections[c].latencies);
+    }
+    qsort(latencies, groups, sizeof(long), compare_long);
+    double p50_us = groups > 0 ? latencies[(long)(0.50 * (groups - 1) + 0.5)] / 1000.0 : 0;
+    double p99_us = groups > 0 ? latencies[(long)(0.99 * (groups - 1) + 0.5)] / 1000.0 : 0;
+    double max_us = groups > 0 ? latencies[groups - 1] / 1000.0 : 0;
+
+    fprintf(stderr, "%s: costruzione %ld comandi in %.3f s; %ld comandi su %ld connessioni in %.3f s (%.0f comandi/s, %.0f query/s)\n",
+            workload_path, setup, setup_seconds, commands, clients, wall, commands / wall, queries / wall);
+    fprintf(stderr, "  gruppi di %ld comandi: p50 %.2f us  p99 %.2f us  max %.2f us\n", depth, p50_us, p99_us, max_us);
+
+    FILE* json = stdout;
+    if (output_path != NULL && (json = fopen(output_path, "w")) == NULL) {
+        fprintf(stderr, "Impossibile scrivere %s\n", output_path);
+        return 1;
+    }
+    fprintf(json, "{\n  \"socket\": \"%s\",\n  \"file\": \"%s\",\n", socket_path, workload_path);
+    fprintf(json, "  \"clients\": %ld,\n  \"depth\": %ld,\n", clients, depth);
+    fprintf(json, "  \"setup_commands\": %ld,\n  \"setup_seconds\": %.6f,\n", setup, setup_seconds);
+    fprintf(json, "  \"commands\": %ld,\n  \"queries\": %ld,\n  \"wall_seconds\": %.6f,\n", commands, queries, wall);
+    fprintf(json, "  \"commands_per_second\": %.1f,\n  \"queries_per_second\": %.1f,\n", commands / wall, queries / wall);
+    fprintf(json, "  \"group_latency\": { \"groups\": %ld, \"p50_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f }\n}\n",
+            groups, p50_us, p99_us, max_us);
+    if (json != stdout) {
+        fclose(json);
+    }
+
+    free(latencies);
+    free(connections);
+    free(threads);
+    free_workload(&w);
+    return 0;
+}
@@ -0,0 +1,182 @@
+// Generatore di carichi sintetici per plan-route.
+//
+//   gcc -O2 bench/workload.c -o workload
+//   ./workload --mix random --stations 100000 --ops 200000 --seed 1 > random.txt
+//
+// Il carico è una fase di costruzione (una aggiungi-stazione per stazione) seguita
+// da --ops comandi estratti secondo il mix:
+//   random     stazioni inserite in ordine casuale, comandi misti
+//   sorted     stazioni inserite in ordine crescente (il caso peggiore per un BST)
+//   dense      come random, ma con 64-512 auto per stazione
+//   sparse     autonomie corte: molti percorsi inesistenti
+//   queries    quasi solo pianifica-percorso
+//   mutations  quasi solo modifiche alla rete
+// Lo stesso seme produce sempre lo stesso file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STATION_SPACING 100
+#define AUTONOMY_VALUES 32  // Autonomie distinte: rottama-auto trova spesso l'auto
+
+typedef struct WorkloadMix {
+    const char* name;
+    bool sorted_insert;
+    int min_cars;
+    int max_cars;
+    int min_autonomy;
+    int max_autonomy;
+    // Percentuali dei comandi dopo la costruzione
+    int query_pct;
+    int add_car_pct;
+    int remove_car_pct;
+    int demolish_pct;
+    int add_station_pct;
+} WorkloadMix;
+
+const WorkloadMix mixes[] = {
+    { "random",    false, 1,   8,   STATION_SPACING,     20 * STATION_SPACING, 40, 20, 20, 10, 10 },
+    { "sorted",    true,  1,   8,   STATION_SPACING,     20 * STATION_SPACING, 40, 20, 20, 10, 10 },
+    { "dense",     false, 64,  512, STATION_SPACING,     20 * STATION_SPACING, 40, 20, 20, 10, 10 },
+    { "sparse",    false, 1,   4,   STATION_SPACING / 2, 2 * STATION_SPACING,  40, 20, 20, 10, 10 },
+    { "queries",   false, 1,   8,   STATION_SPACING,     20 * STATION_SPACING, 95, 2,  1,  1,  1 },
+    { "mutations", false, 1,   8,   STATION_SPACING,     20 * STATION_SPACING, 5,  35, 35, 15, 10 },
+};
+
+// xorshift64*: stesso flusso di numeri su ogni piattaforma
+uint64_t rng_state;
+
+uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+// Intero uniforme in [lo, hi]
+long rng_range(long lo, long hi) {
+    return lo + (long)(rng_next() % (uint64_t)(hi - lo + 1));
+}
+
+int random_autonomy(const WorkloadMix* mix) {
+    int step = (mix->max_autonomy - mix->min_autonomy) / (AUTONOMY_VALUES - 1);
+    return mix->min_autonomy + (int)rng_range(0, AUTONOMY_VALUES - 1) * step;
+}
+
+void usage(const char* program) {
+    fprintf(stderr, "uso: %s [--mix nome] [--stations n] [--ops n] [--span n] [--seed n]\n", program);
+    fprintf(stderr, "mix:");
+    for (size_t i = 0; i < sizeof(mixes) / sizeof(mixes[0]); i++) {
+        fprintf(stderr, " %s", mixes[i].name);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    const WorkloadMix* mix = &mixes[0];
+    long stations = 1000;
+    long ops = 10000;
+    long span = 1000;  // Stazioni massime tra gli estremi di un pianifica-percorso
+    uint64_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        if (strcmp(argv[i], "--mix") == 0) {
+            mix = NULL;
+            for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+                if (strcmp(argv[i + 1], mixes[m].name) == 0) {
+                    mix = &mixes[m];
+                }
+            }
+            if (mix == NULL) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--stations") == 0) {
+            stations = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--ops") == 0) {
+            ops = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--span") == 0) {
+            span = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+        i++;
+    }
+    if (stations < 1 || stations > INT32_MAX / STATION_SPACING || ops < 0 || span < 1) {
+        usage(argv[0]);
+    }
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    static char buffer[1 << 20];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+
+    // Le stazioni iniziali stanno a multipli di STATION_SPACING
+    int* order = (int*)malloc(stations * sizeof(int));
+    if (order == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    for (long k = 0; k < stations; k++) {
+        order[k] = (int)k;
+    }
+    if (!mix->sorted_insert) {
+        for (long k = stations - 1; k > 0; k--) {
+            long j = rng_range(0, k);
+            int temp = order[k];
+            order[k] = order[j];
+            order[j] = temp;
+        }
+    }
+
+    for (long k = 0; k < stations; k++) {
+        int cars = (int)rng_range(mix->min_cars, mix->max_cars);
+        printf("aggiungi-stazione %ld %d", (long)order[k] * STATION_SPACING, cars);
+        for (int c = 0; c < cars; c++) {
+            printf(" %d", random_autonomy(mix));
+        }
+        putchar('\n');
+    }
+    free(order);
+
+    for (long op = 0; op < ops; op++) {
+        long station = rng_range(0, stations - 1) * STATION_SPACING;
+        int pick = (int)rng_range(0, 99);
+
+        if (pick < mix->query_pct) {
+            long other = station + rng_range(1, span) * STATION_SPACING;
+            if (other >= stations * STATION_SPACING) {
+                other = (stations - 1) * STATION_SPACING;
+            }
+            // Metà delle richieste vanno all'indietro
+            if (rng_next() & 1) {
+                printf("pianifica-percorso %ld %ld\n", station, other);
+            } else {
+                printf("pianifica-percorso %ld %ld\n", other, station);
+            }
+        } else if ((pick -= mix->query_pct) < mix->add_car_pct) {
+            printf("aggiungi-auto %ld %d\n", station, random_autonomy(mix));
+        } else if ((pick -= mix->add_car_pct) < mix->remove_car_pct) {
+            printf("rottama-auto %ld %d\n", station, random_autonomy(mix));
+        } else if ((pick -= mix->remove_car_pct) < mix->demolish_pct) {
+            printf("demolisci-stazione %ld\n", station);
+        } else {
+            // Le nuove stazioni cadono tra quelle iniziali
+            int cars = (int)rng_range(mix->min_cars, mix->max_cars);
+            printf("aggiungi-stazione %ld %d", station + rng_range(1, STATION_SPACING - 1), cars);
+            for (int c = 0; c < cars; c++) {
+                printf(" %d", random_autonomy(mix));
+            }
+            putchar('\n');
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+// Lettura dei carichi di workload.c, comune a driver.c e loadgen.c: divide il file
+// in righe, riconosce il tipo di ogni comando e conta le righe di risposta attese.
+
+#ifndef WORKLOAD_IO_H
+#define WORKLOAD_IO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum CommandKind {
+    KIND_AGGIUNGI_STAZIONE,
+    KIND_DEMOLISCI_STAZIONE,
+    KIND_AGGIUNGI_AUTO,
+    KIND_ROTTAMA_AUTO,
+    KIND_PIANIFICA_PERCORSO,
+    KIND_PIANIFICA_PERCORSI,
+    KIND_REGISTRA_PERCORSO,
+    KIND_ALTRO,
+    KIND_COUNT
+} CommandKind;
+
+static const char* const kind_names[KIND_COUNT] = {
+    "aggiungi-stazione",
+    "demolisci-stazione",
+    "aggiungi-auto",
+    "rottama-auto",
+    "pianifica-percorso",
+    "pianifica-percorsi",
+    "registra-percorso",
+    "altro",
+};
+
+// Carico letto in memoria, diviso in righe
+typedef struct Workload {
+    char* data;
+    size_t length;
+    size_t* line_start;   // line_start[count] è la fine dell'ultima riga
+    unsigned char* kind;
+    int* replies;  // Righe di risposta attese
+    long count;
+} Workload;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long now_nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static CommandKind classify(const char* line, size_t length) {
+    for (int k = 0; k < KIND_ALTRO; k++) {
+        size_t n = strlen(kind_names[k]);
+        if (length > n && memcmp(line, kind_names[k], n) == 0 && line[n] == ' ') {
+            return (CommandKind)k;
+        }
+    }
+    return KIND_ALTRO;
+}
+
+// pianifica-percorso con partenza uguale all'arrivo risponde su due righe, così come
+// ogni arrivo di pianifica-percorsi uguale alla partenza; i comandi sconosciuti
+// vengono ignorati
+static int expected_replies(CommandKind kind, const char* line) {
+    if (kind == KIND_ALTRO) {
+        return 0;
+    }
+    if (kind == KIND_PIANIFICA_PERCORSO) {
+        long partenza, arrivo;
+        if (sscanf(line + strlen(kind_names[kind]), "%ld %ld", &partenza, &arrivo) == 2 && partenza == arrivo) {
+            return 2;
+        }
+    }
+    if (kind == KIND_PIANIFICA_PERCORSI) {
+        char* end;
+        long partenza = strtol(line + strlen(kind_names[kind]), &end, 10);
+        long count = strtol(end, &end, 10);
+        int replies = 0;
+        for (long i = 0; i < count; i++) {
+            replies += strtol(end, &end, 10) == partenza ? 2 : 1;
+        }
+        return replies;
+    }
+    return 1;
+}
+
+static void load_workload(Workload* w, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Impossibile aprire %s\n", path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    w->length = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    w->data = (char*)malloc(w->length + 1);
+    if (w->data == NULL || fread(w->data, 1, w->length, file) != w->length) {
+        fprintf(stderr, "Impossibile leggere %s\n", path);
+        exit(1);
+    }
+    fclose(file);
+    w->data[w->length] = '\0';
+
+    long capacity = 1024;
+    w->count = 0;
+    w->line_start = (size_t*)malloc((capacity + 1) * sizeof(size_t));
+    w->kind = (unsigned char*)malloc(capacity);
+    w->replies = (int*)malloc(capacity * sizeof(int));
+
+    size_t pos = 0;
+    while (pos < w->length) {
+        char* newline = memchr(w->data + pos, '\n', w->length - pos);
+        size_t end = newline != NULL ? (size_t)(newline - w->data) + 1 : w->length;
+        if (end - pos > 1) {
+            if (w->count == capacity) {
+                capacity *= 2;
+                w->line_start = (size_t*)realloc(w->line_start, (capacity + 1) * sizeof(size_t));
+                w->kind = (unsigned char*)realloc(w->kind, capacity);
+                w->replies = (int*)realloc(w->replies, capacity * sizeof(int));
+            }
+            if (w->line_start == NULL || w->kind == NULL || w->replies == NULL) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+            }
+            CommandKind kind = classify(w->data + pos, end - pos);
+            w->line_start[w->count] = pos;
+            w->kind[w->count] = (unsigned char)kind;
+            w->replies[w->count] = expected_replies(kind, w->data + pos);
+            w->count++;
+        }
+        pos = end;
+    }
+    // Le righe vuote vengono saltate: ogni comando finisce dove inizia il successivo
+    w->line_start[w->count] = w->length;
+}
+
+static void free_workload(Workload* w) {
+    free(w->data);
+    free(w->line_start);
+    free(w->kind);
+    free(w->replies);
+}
+
+#endif
@@ -3,699 +3,5922 @@
 #include <string.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <time.h>
 
 #define MIN_HEAP_CAPACITY 100
 
-typedef struct MaxHeapAuto {
+// Ordine del B+tree delle stazioni: numero massimo di chiavi per nodo
+#define BTREE_MAX_KEYS 32
+#define BTREE_MIN_KEYS (BTREE_MAX_KEYS / 2 - 1)
+
+// Autonomie distinte memorizzate direttamente nella stazione e numero di classi di
+// dimensione degli array esterni (la classe c contiene FLEET_INLINE_SLOTS << (c + 1) voci)
+#define FLEET_INLINE_SLOTS 2
+#define FLEET_SIZE_CLASSES 24
+#define FLEET_BUILD_MAX_AUTOS 1024  // Auto contate da fleet_build con la tabella sullo stack
+
+// Dimensione indicativa di una slab e del primo blocco dell'arena di una query
+#define SLAB_BYTES (64 * 1024)
+#define ARENA_MIN_BYTES (64 * 1024)
+
+// Modifiche recenti conservate per validare i percorsi in cache e limiti della cache
+#define ROUTE_CHANGE_LOG_SIZE 1024
+#define ROUTE_CACHE_CAPACITY 4096
+#define ROUTE_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+// Dimensione dei blocchi letti dallo standard input e scritti sullo standard output
+#define INPUT_BLOCK_SIZE (1 << 20)
+#define OUTPUT_BLOCK_SIZE (1 << 16)
+#define QUERY_BATCH_MAX 4096
+#define COMMAND_BLOCK_COMMANDS 4096      // Comandi letti in un blocco dallo stadio di lettura
+#define COMMAND_BLOCK_AUTOS (1 << 18)    // Autonomie dopo le quali un blocco si chiude
+#define PIPELINE_BLOCKS 8                // Blocchi di comandi e di risposte in circolo tra gli stadi
+#define SPSC_RING_SLOTS (2 * PIPELINE_BLOCKS)  // Tutti i blocchi pi la fine dell'output
+#define JUMP_MAX_LEVELS 32
+#define SERVER_MAX_CLIENTS 256  // Connessioni servite insieme, ognuna con il suo slot di lettura
+#define SERVER_MAX_COMMAND_AUTOS (1 << 18)  // Lista pi lunga accettata in un comando di un client
+#define VERSION_CHUNK_STATIONS 512  // Stazioni per blocco di una versione pubblicata dal server
+#define STATION_BATCH_MIN 64  // Stazioni nuove sotto cui non conviene ricostruire l'albero
+#define STATION_BATCH_MAX_AUTOS (1 << 20)  // Autonomie nel log oltre le quali lo si applica
+#define MUTATION_LOG_MAX_STATIONS (1 << 18)  // Stazioni in attesa oltre le quali il log si applica comunque
+#define MUTATION_LOG_MIN_SLOTS 256  // Capacit iniziale della tabella hash del log
+#define STATION_ARRAY_MAX_SHIFTS 16  // Stazioni aggiunte o demolite applicate alla vista prima di ricostruirla
+#define SNAPSHOT_MAGIC "PRSNAPSH"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_CHECKSUM_SEED 0xCBF29CE484222325ULL
+
+// Allocatore a slab per oggetti di dimensione fissa: gli oggetti liberati vengono
+// riutilizzati tramite una free list e tutte le slab si rilasciano in un colpo solo
+typedef struct SlabAllocator {
+    size_t object_size;
+    int objects_per_slab;
+    void* free_list;   // Oggetti liberati, collegati tramite il loro primo puntatore
+    char* slabs;       // Slab allocate, collegate tramite il puntatore in testa
+    int used_in_slab;  // Oggetti gi distribuiti dalla slab pi recente
+} SlabAllocator;
+
+// Blocco di memoria di un'arena, preceduto dal puntatore al blocco precedente
+typedef struct ArenaBlock {
+    struct ArenaBlock* previous;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+// Arena per la memoria temporanea di una query, azzerata in un solo passo
+typedef struct Arena {
+    ArenaBlock* block;
+} Arena;
+
+// Autonomie distinte presenti nella stazione con il relativo numero di auto
+typedef struct AutoCount {
+    int autonomy;
+    int count;
+} AutoCount;
+
+// Parco auto di una stazione: multinsieme ordinato per autonomia crescente, quindi
+// l'autonomia massima  l'ultimo elemento. Le prime FLEET_INLINE_SLOTS autonomie
+// distinte stanno nella stazione, oltre si passa a un array esterno che raddoppia.
+typedef struct Fleet {
+    int size;      // Numero di autonomie distinte
+    int capacity;  // FLEET_INLINE_SLOTS finch si usa la memoria interna
+    union {
+        AutoCount inline_items[FLEET_INLINE_SLOTS];
+        AutoCount* items;
+    };
+} Fleet;
+
+typedef struct Station {
+    int distance;
+    Fleet fleet;
+    long long distance_dijkstra;  // Somme di distanze: con molte tappe superano INT_MAX
+    long long sum_distances_from_zero;
+    struct Station* prev;
+    int heap_index;  // Posizione nella coda di priorit di dijkstra_adattato
+    unsigned int search_epoch;  // Query a cui si riferiscono i campi di ricerca
+} Station;
+
+// Nodo del B+tree: le foglie contengono le stazioni ordinate per distanza e sono
+// collegate tra loro, i nodi interni contengono solo le chiavi separatrici.
+// L'albero  aumentato con i reach: ogni foglia tiene l'autonomia massima delle sue
+// stazioni e ogni nodo interno, per ogni figlio, l'intervallo coperto dalle stazioni
+// del sottoalbero, da min(distance - autonomia) a max(distance + autonomia).
+typedef struct BTreeNode {
+    bool is_leaf;
+    int num_keys;
+    int keys[BTREE_MAX_KEYS];
+    union {
+        struct {
+            struct BTreeNode* children[BTREE_MAX_KEYS + 1];
+            int32_t reach_min[BTREE_MAX_KEYS + 1];
+            int32_t reach_max[BTREE_MAX_KEYS + 1];
+        };
+        struct {
+            Station* stations[BTREE_MAX_KEYS];
+            int32_t autonomy[BTREE_MAX_KEYS];  // 0 per una stazione senza auto
+        };
+    };
+    struct BTreeNode* next;  // Foglia successiva (solo per le foglie)
+} BTreeNode;
+
+// Modifica che pu cambiare i percorsi che attraversano la stazione indicata
+typedef struct RouteChange {
+    int distance;
+    bool endpoint;  // Stazione aggiunta o demolita: conta anche come estremo del percorso
+} RouteChange;
+
+// Indice a salti per la raggiungibilit sulle stazioni in ordine di distanza.
+// reach[i]  la posizione pi lontana raggiungibile dalla stazione i; per ogni
+// livello k, jump[k][i]  la stazione in cui arriva la ricerca golosa da i dopo
+// 2^k tappe e range_max[k][i] la stazione con reach massimo in [i, i + 2^k).
+// Sono scostamenti da i, quindi restano validi quando le stazioni scorrono.
+typedef struct JumpIndex {
+    bool enabled;
+    bool built;
+    unsigned long long version;  // route_version a cui si riferisce l'indice
+    int count;
+    int capacity;
+    int levels;
+    int* distance;
+    long long* reach;
+    int* jump[JUMP_MAX_LEVELS];
+    int* range_max[JUMP_MAX_LEVELS];
+} JumpIndex;
+
+// Vista struct-of-arrays delle stazioni in ordine di distanza: la ricerca legge
+// solo posizione e reach, che qui stanno in due array contigui invece che dietro
+// ai puntatori delle foglie e dei parchi auto
+typedef struct StationArray {
+    bool enabled;
+    bool built;
+    unsigned long long version;  // route_version a cui si riferisce la vista
+    int count;
+    int capacity;
+    int32_t* distance;
+    int32_t* max_reach;  // distance + autonomia massima, limitato a INT32_MAX
+} StationArray;
+
+typedef struct StationIndex {
+    BTreeNode* root;
     int size;
-    int array_auto[512];
-} MaxHeapAuto;
+    unsigned long long route_version;  // Cresce a ogni modifica che pu cambiare un percorso
+    RouteChange route_changes[ROUTE_CHANGE_LOG_SIZE];  // Ultime modifiche, per versione
+    SlabAllocator station_pool;
+    SlabAllocator node_pool;
+    SlabAllocator fleet_pools[FLEET_SIZE_CLASSES];  // Array esterni dei parchi auto
+    JumpIndex jump;  // Attivo con --jump-index
+    StationArray array;  // Attiva con --soa
+} StationIndex;
+
+// Intestazione dello snapshot binario (--save-snapshot / --load-snapshot)
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t station_count;
+    uint64_t item_count;        // Voci AutoCount dopo le stazioni
+    uint64_t body_checksum;     // Stazioni e autonomie
+    uint64_t header_checksum;   // Campi precedenti
+} SnapshotHeader;
+
+// Stazione nello snapshot: il suo parco auto sono fleet_size voci da fleet_offset
+typedef struct SnapshotStation {
+    int32_t distance;
+    uint32_t fleet_size;
+    uint64_t fleet_offset;
+} SnapshotStation;
+
+// Posizione di una stazione all'interno delle foglie, per la visita in ordine
+typedef struct StationCursor {
+    BTreeNode* leaf;
+    int pos;
+} StationCursor;
+
+// Stazioni nuove del log delle modifiche, caricate insieme da add_station_batch
+typedef struct StationBatchItem {
+    int distance;
+    int num_auto;
+    int first_auto;  // Prima autonomia della stazione in StationBatch.autonomies
+    int order;       // Posizione del comando nel batch
+} StationBatchItem;
 
-typedef struct BSTNode {
+typedef struct StationBatch {
+    StationBatchItem* items;
+    bool* added;  // Esito di ogni comando, in ordine di arrivo
+    int count;
+    int capacity;
+    int* autonomies;
+    int autonomies_count;
+    int autonomies_capacity;
+} StationBatch;
+
+// Variazione del parco auto di una stazione in attesa nel log
+typedef struct PendingCar {
+    int autonomy;
+    int count;  // Auto aggiunte meno auto rottamate
+    int next;   // Variazione successiva della stessa stazione, -1 alla fine
+} PendingCar;
+
+// Stato di una stazione toccata da modifiche non ancora applicate all'indice
+typedef struct PendingStation {
     int distance;
-    MaxHeapAuto* auto_heap;
-    struct BSTNode* left;
-    struct BSTNode* right;
-    int distance_dijkstra;
-    int sum_distances_from_zero ;
-    struct BSTNode* prev;
-} BSTNode;
+    Station* base;    // Stazione dell'indice, NULL se non c'
+    bool exists;      // La stazione c' nella rete vista dai comandi
+    bool replaced;    // base va demolita e, se exists, sostituita da una stazione nuova
+    int first_auto;   // replaced: autonomie dell'ultimo aggiungi-stazione in MutationLog.autonomies
+    int num_auto;
+    int cars;         // Prima variazione del parco auto, -1 se nessuna
+    int slot;         // Posizione in MutationLog.slots
+} PendingStation;
+
+// Log delle modifiche: le risposte si calcolano subito sull'indice pi il log, ma
+// l'indice cambia solo quando una query ha bisogno della rete aggiornata. Le
+// modifiche della stessa stazione si compensano nel log, cos un'auto aggiunta e
+// poi rottamata, o una stazione aggiunta e poi demolita, non toccano mai l'albero.
+typedef struct MutationLog {
+    PendingStation* stations;
+    int count;
+    int capacity;
+    int* slots;          // Tabella hash da distance a stations, -1 se vuota
+    int slots_capacity;  // Potenza di due, almeno il doppio di count
+    PendingCar* cars;
+    int cars_count;
+    int cars_capacity;
+    int* autonomies;
+    int autonomies_count;
+    int autonomies_capacity;
+    StationBatch batch;  // Stazioni nuove, caricate insieme da add_station_batch
+} MutationLog;
 
 typedef struct MinHeapNode {
-    int distance_dijkstra;
-    int sum_distances_from_zero;
-    BSTNode* bst_node;
+    long long distance_dijkstra;
+    long long sum_distances_from_zero;
+    Station* station;
 } MinHeapNode;
 
+// Coda di priorit indicizzata: gli elementi sono memorizzati direttamente nell'array
+// e ogni stazione ricorda la propria posizione in heap_index (-1 se non  in coda)
 typedef struct MinHeap {
     int size;
     int capacity;
-    MinHeapNode** array;
+    MinHeapNode* array;
+    Arena* arena;  // Arena della query da cui proviene l'array
 } MinHeap;
 
-void max_heapify(MaxHeapAuto* heap, int idx);
+// Memoria di lavoro del pianificatore lineare, riutilizzata tra le query
+typedef struct RouteWorkspace {
+    Station** window;  // Stazioni dell'intervallo [dest, src] in ordine di distanza
+    int* prev;         // Indice nella finestra del predecessore di ogni stazione
+    int32_t* autonomy; // Autonomia massima delle stazioni della finestra, letta dalle foglie
+    int* path;         // Distanze delle tappe del percorso, da dest a src
+    int capacity;
+    int path_length;
+    Arena arena;       // Memoria temporanea di dijkstra_adattato
+    int* verify_path;  // Tappe del primo motore in modalit di verifica
+    int verify_capacity;
+    int32_t* view_distance;  // Finestra di una versione del server, copiata dai blocchi
+    int32_t* view_reach;
+    int view_capacity;
+} RouteWorkspace;
 
-BSTNode* create_bst_node(int distance) {
-    BSTNode* new_node = (BSTNode*)malloc(sizeof(BSTNode));
+// Motore di pianificazione: riceve l'indice e gli estremi, con dest < src, e scrive
+// le tappe in ws->path. Restituisce 0 se il percorso non esiste.
+typedef struct PlannerEngine {
+    const char* name;
+    bool needs_array;      // Legge la vista struct-of-arrays, aggiornata prima delle query
+    bool needs_jump;       // Legge l'indice a salti, aggiornato prima delle query
+    bool writes_stations;  // Scrive nelle stazioni: le query restano sequenziali
+    bool one_to_many;      // pianifica-percorsi usa la ricerca unica, che d le stesse tappe
+    int (*plan)(StationIndex* index, RouteWorkspace* ws, int dest, int src);
+    int (*plan_array)(StationArray* array, RouteWorkspace* ws, int dest, int src);  // Solo sulla vista, per il server
+} PlannerEngine;
 
-    if (new_node == NULL) {
-        printf("Memory allocation failed\n");
-        exit(1);
-    }
+// Motore di pianifica-percorso (--engine) ed eventuale secondo motore eseguito su
+// ogni query per confrontare i percorsi (--verify-engine)
+PlannerEngine* planner_engine = NULL;
+PlannerEngine* verify_engine = NULL;
 
-    new_node->distance = distance;
-    new_node->auto_heap = NULL;
-    new_node->left = NULL;
-    new_node->right = NULL;
+// Tempo speso da ciascun motore in modalit di verifica
+typedef struct VerifyTiming {
+    atomic_ulong queries;
+    atomic_ulong ns[2];
+} VerifyTiming;
 
-    // Inizializzazione dei campi per Dijkstra
-    new_node->distance_dijkstra = INT_MAX;
-    new_node->sum_distances_from_zero = 0;
-    new_node->prev = NULL;
+VerifyTiming verify_timing;
 
-    return new_node;
-}
+// Lettore dell'input a blocchi: i token vengono restituiti come puntatori nel buffer,
+// che contiene un blocco letto da un descrittore oppure l'intero file mappato in memoria
+typedef struct InputReader {
+    int fd;
+    char* data;
+    size_t length;    // Byte validi in data
+    size_t pos;       // Primo byte non ancora consumato
+    size_t capacity;
+    bool mapped;
+    bool eof;         // Il descrittore non ha altri dati
+    struct OutputBuffer* flush_before_read;  // Svuotato prima di ogni read che pu bloccarsi
+    int max_list;     // Valori massimi in una lista di un comando, 0 senza limite
+} InputReader;
 
-void reset_dijkstra_values(BSTNode* node) {
-    if (node == NULL) {
-        return;
-    }
-    node->distance_dijkstra = INT_MAX;
-    node->sum_distances_from_zero = 0;
-    node->prev = NULL;
-    reset_dijkstra_values(node->left);
-    reset_dijkstra_values(node->right);
-}
+// Buffer delle risposte: gli interi vengono formattati direttamente nel buffer, che
+// viene scritto sul descrittore a blocchi. Con fd == -1 resta in memoria e cresce.
+typedef struct OutputBuffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+    int fd;
+    bool closed;  // Il client del server ha chiuso la connessione: le risposte si scartano
+    struct Pipeline* pipeline;  // Se presente, i blocchi pieni vanno allo stadio di scrittura
+} OutputBuffer;
 
-BSTNode* search_station(BSTNode* root, int distance) {
-    // Caso base: l'albero  vuoto o abbiamo trovato la stazione
-    if (root == NULL || root->distance == distance) {
-        return root;
-    }
+// Voce della cache dei percorsi: risposta gi formattata per (partenza, arrivo),
+// valida per l'indice alla versione version
+typedef struct RouteCacheEntry {
+    int partenza;
+    int arrivo;
+    unsigned long long version;
+    char* text;
+    size_t length;
+    int bucket_next;  // Voce successiva nello stesso bucket (o nella lista libera)
+    int lru_prev;
+    int lru_next;
+} RouteCacheEntry;
 
-    // Altrimenti, ricorre sul sottalbero appropriato
-    if (distance < root->distance) {
-        return search_station(root->left, distance);
-    } else {
-        return search_station(root->right, distance);
-    }
-}
+// Cache LRU limitata delle risposte di pianifica-percorso
+typedef struct RouteCache {
+    RouteCacheEntry* entries;
+    int* buckets;
+    int bucket_mask;
+    int capacity;
+    int used;         // Voci mai assegnate iniziano da used
+    int free_head;    // Voci sfrattate da riutilizzare
+    int lru_head;     // Voce usata pi di recente
+    int lru_tail;
+    size_t bytes;
+    size_t max_bytes;
+} RouteCache;
 
-// Funzione ausiliaria per trovare il nodo con il valore minimo
-// (usata per trovare il successore in ordine di un nodo)
-BSTNode* minValueNode(BSTNode* node) {
-    BSTNode* current = node;
+// Percorso registrato con registra-percorso: la finestra di stazioni tra gli estremi
+// e le etichette della pianificazione restano in memoria e vengono riparate a ogni
+// modifica che le riguarda, cos la risposta  sempre pronta
+typedef struct RouteSubscription {
+    int partenza;
+    int arrivo;
+    int count;            // Stazioni nella finestra
+    int failed;           // Prima stazione non raggiungibile, count se lo sono tutte
+    int* distance;        // Distanze della finestra: le stazioni si cercano nell'indice
+    RouteWorkspace ws;    // Autonomie massime della finestra, etichette prev e tappe
+    bool dirty;           // La risposta va formattata di nuovo
+    OutputBuffer text;
+} RouteSubscription;
 
-    // Scorri fino a trovare il nodo pi a sinistra (il pi piccolo)
-    while (current && current->left != NULL) {
-        current = current->left;
-    }
+// Percorsi registrati, ordinati per (partenza, arrivo)
+typedef struct RouteSubscriptions {
+    RouteSubscription* items;
+    int count;
+    int capacity;
+    unsigned long long version;  // route_version gi applicata
+} RouteSubscriptions;
 
-    return current;
-}
+// pianifica-percorso in attesa nel batch corrente
+typedef struct RouteQuery {
+    int partenza;
+    int arrivo;
+    int subscription; // Percorso registrato che risponde, -1 se non c'
+    int cache_entry;  // Voce valida della cache, -1 se la risposta va calcolata
+    int worker;       // Worker che ha formattato la risposta
+    size_t offset;    // Inizio della risposta nel buffer del worker
+    size_t length;
+} RouteQuery;
 
-BSTNode* delete_station(BSTNode* root, int distance, int* is_removed) {
-    // Caso base: l'albero  vuoto
-    if (root == NULL) {
-        *is_removed = 0;  // Imposta il flag per indicare che la stazione NON  stata rimossa
-        return root;
-    }
+struct QueryPool;
 
-    // Ricorre sul sottalbero appropriato per trovare la stazione da rimuovere
-    if (distance < root->distance) {
-        root->left = delete_station(root->left, distance, is_removed);
-    } else if (distance > root->distance) {
-        root->right = delete_station(root->right, distance, is_removed);
-    } else {
-        // Nodo con solo un figlio o nessun figlio
-        if (root->left == NULL) {
-            BSTNode* temp = root->right;
-            if (root->auto_heap != NULL) {
-                free(root->auto_heap);
-            }
-            free(root);
-            *is_removed = 1;  // Imposta il flag per indicare che la stazione  stata rimossa
-            return temp;
-        } else if (root->right == NULL) {
-            BSTNode* temp = root->left;
-            if (root->auto_heap != NULL) {
-                free(root->auto_heap);
-            }
-            free(root);
-            *is_removed = 1;  // Imposta il flag per indicare che la stazione  stata rimossa
-            return temp;
-        }
+typedef struct QueryWorker {
+    struct QueryPool* pool;
+    int id;
+    RouteWorkspace workspace;
+    OutputBuffer output;  // Risposte del batch, in memoria
+} QueryWorker;
 
-        // Nodo con due figli: trova il successore in ordine (il pi piccolo
-        // nodo nel sottoalbero destro)
-        BSTNode* temp = minValueNode(root->right);
+// Pool di thread per i batch di pianifica-percorso: il pianificatore a sweep
+// legge soltanto l'indice, quindi le richieste di un batch sono indipendenti
+typedef struct QueryPool {
+    int num_workers;          // Compreso il thread principale
+    QueryWorker* workers;
+    pthread_t* threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    unsigned long generation; // Batch pubblicati finora
+    int busy;                 // Thread che non hanno ancora finito il batch
+    bool shutdown;
+    StationIndex* index;
+    RouteQuery* queries;
+    int count;
+    atomic_int next;          // Prossima richiesta da assegnare
+} QueryPool;
 
-        // Libera l'auto_heap corrente se esiste
-        if (root->auto_heap != NULL) {
-            free(root->auto_heap);
-        }
+// Coda a produttore e consumatore singoli tra due stadi della pipeline. push e pop
+// non prendono lock; il consumatore che trova la coda vuota dorme sulla condition
+// variable, e il produttore lo sveglia solo se sleeping  impostato.
+typedef struct SpscRing {
+    atomic_size_t head;  // Prossimo elemento da leggere
+    atomic_size_t tail;  // Prossimo slot da scrivere
+    void* slots[SPSC_RING_SLOTS];
+    atomic_bool sleeping;
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;
+} SpscRing;
 
-        // Copia il contenuto del successore in ordine nel nodo
-        root->distance = temp->distance;
-        root->auto_heap = temp->auto_heap;
+typedef enum CommandType {
+    CMD_AGGIUNGI_STAZIONE,
+    CMD_DEMOLISCI_STAZIONE,
+    CMD_AGGIUNGI_AUTO,
+    CMD_ROTTAMA_AUTO,
+    CMD_PIANIFICA_PERCORSO,
+    CMD_REGISTRA_PERCORSO,
+    CMD_PIANIFICA_PERCORSI,
+    CMD_SCONOSCIUTO
+} CommandType;
 
-        // Imposta l'auto_heap del nodo da eliminare a NULL per evitare deallocazione
-        temp->auto_heap = NULL;  // Aggiungi questa linea
+// Comando gi convertito dallo stadio di lettura
+typedef struct ParsedCommand {
+    CommandType type;
+    int args[2];     // Argomenti nell'ordine del comando; per aggiungi-stazione distanza e numero di
+                     // auto, per pianifica-percorsi partenza e numero di arrivi
+    int first_auto;  // Prima autonomia, o primo arrivo, in CommandBlock.autonomies
+} ParsedCommand;
 
-        // Rimuovi il successore in ordine
-        root->right = delete_station(root->right, temp->distance, is_removed);
-    }
+typedef struct CommandBlock {
+    ParsedCommand commands[COMMAND_BLOCK_COMMANDS];
+    int count;
+    int* autonomies;
+    int autonomies_count;
+    int autonomies_capacity;
+    bool end;          // Dopo questo blocco l'input  finito
+    bool input_error;  // Dopo questo blocco c' un comando incompleto
+} CommandBlock;
 
-    return root;
-}
+// Pipeline a tre stadi: un thread legge e converte i comandi a blocchi, il thread
+// principale li esegue in ordine e un thread scrive le risposte. I blocchi di
+// comandi e di risposte sono PIPELINE_BLOCKS per tipo e tornano indietro vuoti,
+// quindi uno stadio pi lento ferma gli altri invece di far crescere la memoria.
+typedef struct Pipeline {
+    SpscRing full_blocks;   // Comandi letti, verso l'esecuzione
+    SpscRing free_blocks;   // Blocchi eseguiti, di nuovo alla lettura
+    SpscRing full_chunks;   // Risposte verso la scrittura; NULL chiude lo stadio
+    SpscRing free_chunks;   // Buffer gi scritti
+    CommandBlock* blocks;
+    OutputBuffer chunks[PIPELINE_BLOCKS];
+    struct InputReader* input;
+    int fd;
+    pthread_t reader;
+    pthread_t writer;
+} Pipeline;
 
-MaxHeapAuto* create_max_heap_auto() {
-    MaxHeapAuto* heap = (MaxHeapAuto*)malloc(sizeof(MaxHeapAuto));
+// Comandi da eseguire: dalla pipeline o, senza, letti dal thread principale un
+// blocco alla volta
+typedef struct CommandSource {
+    struct InputReader* input;
+    Pipeline* pipeline;
+    OutputBuffer* output;  // Svuotato prima di attendere lo stadio di lettura
+    CommandBlock* block;   // Blocco corrente
+    int pos;               // Prossimo comando del blocco
+} CommandSource;
 
-    if (heap == NULL) {
-        printf("Memory allocation failed\n");
-        exit(1);
-    }
+// Blocco di stazioni consecutive di una versione, con distance e reach come in
+// StationArray. Le versioni successive condividono i blocchi che le modifiche non
+// toccano: un blocco condiviso non cambia pi, lo scrittore ne modifica una copia.
+typedef struct VersionChunk {
+    int refs;   // Versioni che lo usano, contate solo dallo scrittore
+    int count;
+    int32_t distance[VERSION_CHUNK_STATIONS];
+    int32_t max_reach[VERSION_CHUNK_STATIONS];
+} VersionChunk;
 
-    heap->size = 0;
+// Versione immutabile della rete pubblicata dal server (--server). Un lettore la usa
+// senza lock dopo averla annunciata nel suo slot; lo scrittore libera le versioni
+// ritirate solo quando nessuno slot le annuncia pi
+typedef struct NetworkVersion {
+    unsigned long long version;  // route_version dell'indice pubblicato
+    int count;        // Stazioni
+    int num_chunks;
+    int capacity;
+    VersionChunk** chunks;  // In ordine di distanza, nessuno vuoto
+    int32_t* first;         // Prima distanza di ogni blocco
+    struct NetworkVersion* next;  // Versioni ritirate in attesa di essere liberate
+} NetworkVersion;
 
-    return heap;
-}
+// Modifiche consecutive di un client, applicate dallo scrittore del server. Comandi
+// e autonomie restano nel blocco del client, che attende la risposta senza leggere
+typedef struct MutationRequest {
+    ParsedCommand* commands;
+    int count;
+    int* autonomies;
+    OutputBuffer responses;  // In memoria: lo scrittore non si blocca su un client lento
+    bool done;
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;
+    struct MutationRequest* next;
+} MutationRequest;
 
-void insert_auto(BSTNode* root, int distance, int autonomy, int* is_added) {
-    BSTNode* station = search_station(root, distance);
+typedef struct Server {
+    StationIndex* index;
+    _Atomic(NetworkVersion*) current;
+    _Atomic(NetworkVersion*) hazards[SERVER_MAX_CLIENTS];  // Versione in uso da ogni lettore
+    NetworkVersion* retired;
+    MutationLog log;        // Usato solo dallo scrittore
+    pthread_mutex_t mutex;  // Protegge la coda delle modifiche e le connessioni
+    pthread_cond_t queue_ready;
+    pthread_cond_t clients_done;
+    MutationRequest* queue_head;
+    MutationRequest* queue_tail;
+    int client_fds[SERVER_MAX_CLIENTS];  // -1: slot libero
+    int active_clients;
+    bool stopping;
+} Server;
 
-    if (station == NULL) {
-        *is_added = 0;  // Imposta il flag per indicare che l'auto NON  stata aggiunta
-        return;
-    }
+typedef struct ServerClient {
+    Server* server;
+    int fd;
+    int slot;
+    MutationRequest request;
+} ServerClient;
 
-    MaxHeapAuto* heap = station->auto_heap;
+// Strumentazione: compilata solo con -DPLAN_ROUTE_STATS e attiva solo se si passa
+// --stats [file] oppure la variabile d'ambiente PLAN_ROUTE_STATS=file ("-", o --stats
+// senza file, per stderr).
+// I risultati vengono scritti in JSON all'uscita e a ogni SIGUSR1.
+#ifdef PLAN_ROUTE_STATS
 
-    // Inserisce la nuova auto alla fine del heap
-    heap->size++;
-    int i = heap->size - 1;
-    heap->array_auto[i] = autonomy;
+#define STATS_HISTOGRAM_BUCKETS 40  // Bucket k: latenze in [2^(k-1), 2^k) ns
 
-    // Sposta la nuova auto alla posizione corretta nel heap
-    while (i != 0 && heap->array_auto[(i - 1) / 2] < heap->array_auto[i]) {
-        int temp = heap->array_auto[i];
-        heap->array_auto[i] = heap->array_auto[(i - 1) / 2];
-        heap->array_auto[(i - 1) / 2] = temp;
-        i = (i - 1) / 2;
-    }
+typedef struct LatencyHistogram {
+    atomic_ulong count;
+    atomic_ulong total_ns;
+    atomic_ulong buckets[STATS_HISTOGRAM_BUCKETS];
+} LatencyHistogram;
 
-    *is_added = 1;  // Imposta il flag per indicare che l'auto  stata aggiunta
-}
+typedef struct RunStats {
+    bool enabled;
+    const char* path;
+    LatencyHistogram commands[CMD_SCONOSCIUTO + 1];
+    // Contatori di lavoro, sommati su tutte le query e su tutti i thread
+    atomic_ulong route_queries;        // pianifica-percorso calcolati
+    atomic_ulong cache_hits;
+    atomic_ulong subscription_hits;
+    atomic_ulong sweep_stations;       // Stazioni nelle finestre di sweep_percorso
+    atomic_ulong jump_hops;            // Tappe ricostruite da jump_percorso
+    atomic_ulong nodes_expanded;       // Stazioni estratte dalla coda di dijkstra_adattato
+    atomic_ulong relaxations;
+    atomic_ulong heap_pushes;
+    atomic_ulong heap_decrease_keys;
+    atomic_ulong tree_descents;        // Discese nel B+tree
+    atomic_ulong tree_nodes_visited;
+    atomic_ulong log_flushes;          // Applicazioni del log delle modifiche
+    atomic_ulong log_stations;         // Stazioni del log che hanno cambiato l'indice
+    atomic_ulong input_refills;
+    atomic_ulong input_bytes;
+} RunStats;
 
-// Funzione ausiliaria per mantenere la propriet di max heap
-void max_heapify(MaxHeapAuto* heap, int idx) {
-    int largest = idx;
-    int left = 2 * idx + 1;
-    int right = 2 * idx + 2;
+RunStats stats;
+volatile sig_atomic_t stats_dump_requested = 0;
+
+const char* command_names[CMD_SCONOSCIUTO + 1] = {
+    "aggiungi-stazione",
+    "demolisci-stazione",
+    "aggiungi-auto",
+    "rottama-auto",
+    "pianifica-percorso",
+    "registra-percorso",
+    "pianifica-percorsi",
+    "sconosciuto",
+};
 
-    if (left < heap->size && heap->array_auto[left] > heap->array_auto[largest]) {
-        largest = left;
+void stats_add(atomic_ulong* counter, unsigned long n) {
+    if (stats.enabled) {
+        atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
     }
-    if (right < heap->size && heap->array_auto[right] > heap->array_auto[largest]) {
-        largest = right;
+}
+
+unsigned long stats_now(void) {
+    if (!stats.enabled) {
+        return 0;
     }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
 
-    if (largest != idx) {
-        int temp = heap->array_auto[idx];
-        heap->array_auto[idx] = heap->array_auto[largest];
-        heap->array_auto[largest] = temp;
-        max_heapify(heap, largest);
+void stats_record(CommandType command, unsigned long start) {
+    if (!stats.enabled) {
+        return;
     }
+    unsigned long ns = stats_now() - start;
+    int bucket = ns == 0 ? 0 : 64 - __builtin_clzl(ns);
+    if (bucket >= STATS_HISTOGRAM_BUCKETS) {
+        bucket = STATS_HISTOGRAM_BUCKETS - 1;
+    }
+    LatencyHistogram* h = &stats.commands[command];
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->buckets[bucket], 1, memory_order_relaxed);
 }
 
-void remove_auto(BSTNode* root, int distance, int autonomy, int* is_removed) {
-    // Cerca la stazione con la distanza specificata nel BST
-    BSTNode* station = search_station(root, distance);
+// Limite superiore del bucket che contiene il percentile p
+unsigned long stats_percentile(LatencyHistogram* h, double p) {
+    unsigned long count = atomic_load(&h->count);
+    unsigned long seen = 0;
+    for (int k = 0; k < STATS_HISTOGRAM_BUCKETS; k++) {
+        seen += atomic_load(&h->buckets[k]);
+        if (seen > 0 && seen >= p * count) {
+            return 1UL << k;
+        }
+    }
+    return 1UL << (STATS_HISTOGRAM_BUCKETS - 1);
+}
 
-    if (station == NULL) {
-        *is_removed = 0;  // Imposta il flag per indicare che l'auto NON  stata rimossa
+void stats_dump(void) {
+    stats_dump_requested = 0;
+    if (!stats.enabled) {
         return;
     }
 
-    MaxHeapAuto* heap = station->auto_heap;
+    FILE* file = strcmp(stats.path, "-") == 0 ? stderr : fopen(stats.path, "w");
+    if (file == NULL) {
+        return;
+    }
 
-    // Cerca l'auto con l'autonomia specificata
-    int i;
-    for (i = 0; i < heap->size; i++) {
-        if (heap->array_auto[i] == autonomy) {
-            break;
+    fprintf(file, "{\n  \"commands\": {");
+    bool first = true;
+    for (int c = 0; c <= CMD_SCONOSCIUTO; c++) {
+        LatencyHistogram* h = &stats.commands[c];
+        unsigned long count = atomic_load(&h->count);
+        if (count == 0) {
+            continue;
+        }
+        fprintf(file, "%s\n    \"%s\": { \"count\": %lu, \"total_ns\": %lu, \"mean_ns\": %lu, \"p50_ns\": %lu, \"p99_ns\": %lu, \"histogram_ns\": {",
+                first ? "" : ",", command_names[c], count, atomic_load(&h->total_ns), atomic_load(&h->total_ns) / count,
+                stats_percentile(h, 0.50), stats_percentile(h, 0.99));
+        bool first_bucket = true;
+        for (int k = 0; k < STATS_HISTOGRAM_BUCKETS; k++) {
+            unsigned long n = atomic_load(&h->buckets[k]);
+            if (n > 0) {
+                fprintf(file, "%s\"%lu\": %lu", first_bucket ? "" : ", ", 1UL << k, n);
+                first_bucket = false;
+            }
         }
+        fprintf(file, "} }");
+        first = false;
     }
 
-    if (i == heap->size) {
-        *is_removed = 0;  // Imposta il flag per indicare che l'auto NON  stata rimossa
+    unsigned long queries = atomic_load(&stats.route_queries);
+    fprintf(file, "\n  },\n  \"work\": {\n");
+    fprintf(file, "    \"route_queries\": %lu,\n", queries);
+    fprintf(file, "    \"cache_hits\": %lu,\n", atomic_load(&stats.cache_hits));
+    fprintf(file, "    \"subscription_hits\": %lu,\n", atomic_load(&stats.subscription_hits));
+    fprintf(file, "    \"sweep_stations\": %lu,\n", atomic_load(&stats.sweep_stations));
+    fprintf(file, "    \"jump_hops\": %lu,\n", atomic_load(&stats.jump_hops));
+    fprintf(file, "    \"nodes_expanded\": %lu,\n", atomic_load(&stats.nodes_expanded));
+    fprintf(file, "    \"relaxations\": %lu,\n", atomic_load(&stats.relaxations));
+    fprintf(file, "    \"heap_pushes\": %lu,\n", atomic_load(&stats.heap_pushes));
+    fprintf(file, "    \"heap_decrease_keys\": %lu,\n", atomic_load(&stats.heap_decrease_keys));
+    fprintf(file, "    \"tree_descents\": %lu,\n", atomic_load(&stats.tree_descents));
+    fprintf(file, "    \"tree_nodes_visited\": %lu,\n", atomic_load(&stats.tree_nodes_visited));
+    fprintf(file, "    \"log_flushes\": %lu,\n", atomic_load(&stats.log_flushes));
+    fprintf(file, "    \"log_stations\": %lu,\n", atomic_load(&stats.log_stations));
+    fprintf(file, "    \"input_refills\": %lu,\n", atomic_load(&stats.input_refills));
+    fprintf(file, "    \"input_bytes\": %lu\n  },\n", atomic_load(&stats.input_bytes));
+
+    // Medie per pianifica-percorso calcolato
+    double per = queries > 0 ? 1.0 / queries : 0.0;
+    fprintf(file, "  \"per_query\": {\n");
+    fprintf(file, "    \"sweep_stations\": %.2f,\n", atomic_load(&stats.sweep_stations) * per);
+    fprintf(file, "    \"jump_hops\": %.2f,\n", atomic_load(&stats.jump_hops) * per);
+    fprintf(file, "    \"nodes_expanded\": %.2f,\n", atomic_load(&stats.nodes_expanded) * per);
+    fprintf(file, "    \"relaxations\": %.2f,\n", atomic_load(&stats.relaxations) * per);
+    fprintf(file, "    \"heap_pushes\": %.2f,\n", atomic_load(&stats.heap_pushes) * per);
+    fprintf(file, "    \"heap_decrease_keys\": %.2f\n  },\n", atomic_load(&stats.heap_decrease_keys) * per);
+
+    unsigned long descents = atomic_load(&stats.tree_descents);
+    fprintf(file, "  \"mean_tree_depth\": %.2f\n}\n", descents > 0 ? (double)atomic_load(&stats.tree_nodes_visited) / descents : 0.0);
+
+    if (file == stderr) {
+        fflush(file);
+    } else {
+        fclose(file);
+    }
+}
+
+void stats_signal_handler(int signal) {
+    (void)signal;
+    stats_dump_requested = 1;
+}
+
+void stats_init(const char* path) {
+    if (path == NULL) {
+        path = getenv("PLAN_ROUTE_STATS");
+    }
+    if (path == NULL || path[0] == '\0') {
         return;
     }
+    stats.enabled = true;
+    stats.path = path;
 
-    // Sostituisce l'auto con l'ultima auto nel heap
-    heap->array_auto[i] = heap->array_auto[heap->size - 1];
-    heap->size--;
+    // Senza SA_RESTART una read bloccata si interrompe e il dump parte subito
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stats_signal_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+#define STATS_ADD(counter, n) stats_add(&stats.counter, (n))
+#define STATS_TIMER_START(timer) unsigned long timer = stats_now()
+#define STATS_TIMER_STOP(timer, command) stats_record((command), (timer))
+#define STATS_POLL() do { if (stats_dump_requested) stats_dump(); } while (0)
+
+#else
+
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_TIMER_START(timer) ((void)0)
+#define STATS_TIMER_STOP(timer, command) ((void)0)
+#define STATS_POLL() ((void)0)
 
-    // Ripristina la propriet di max heap
-    max_heapify(heap, i);
+#endif
 
-    *is_removed = 1;  // Imposta il flag per indicare che l'auto  stata rimossa
+#define STATS_INC(counter) STATS_ADD(counter, 1)
+
+void fleet_release(StationIndex* index, Fleet* fleet);
+
+void init_slab_allocator(SlabAllocator* pool, size_t object_size) {
+    // Ogni oggetto deve poter contenere il collegamento della free list
+    if (object_size < sizeof(void*)) {
+        object_size = sizeof(void*);
+    }
+    object_size = (object_size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+
+    pool->object_size = object_size;
+    pool->objects_per_slab = SLAB_BYTES / object_size > 0 ? SLAB_BYTES / object_size : 1;
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pool->used_in_slab = pool->objects_per_slab;
 }
 
-int get_max_autonomy_auto(MaxHeapAuto* heap) {
-    if (heap->size == 0) {
-        return -1;  // Indica che la coda di priorit  vuota
+void* slab_alloc(SlabAllocator* pool) {
+    // Riutilizza prima gli oggetti liberati
+    if (pool->free_list != NULL) {
+        void* object = pool->free_list;
+        pool->free_list = *(void**)object;
+        return object;
     }
 
-    return heap->array_auto[0];
+    if (pool->used_in_slab == pool->objects_per_slab) {
+        char* slab = (char*)malloc(sizeof(void*) + pool->objects_per_slab * pool->object_size);
+        if (slab == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+        *(char**)slab = pool->slabs;
+        pool->slabs = slab;
+        pool->used_in_slab = 0;
+    }
+
+    return pool->slabs + sizeof(void*) + pool->object_size * pool->used_in_slab++;
 }
 
-BSTNode* add_car(BSTNode* root, int distance, int num_auto, int autonomies[], int* is_station_added) {
-    // Inizio codice di insert_station
-    if (root == NULL) {
-        *is_station_added = 1;
-        root = create_bst_node(distance);
+void slab_free(SlabAllocator* pool, void* object) {
+    *(void**)object = pool->free_list;
+    pool->free_list = object;
+}
 
-        // Utilizza il riferimento alla nuova stazione per creare il max_heap e inserire le auto
-        root->auto_heap = create_max_heap_auto();
-        MaxHeapAuto* heap = root->auto_heap;
+// Rilascia tutte le slab senza visitare i singoli oggetti
+void slab_release_all(SlabAllocator* pool) {
+    while (pool->slabs != NULL) {
+        char* next = *(char**)pool->slabs;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+    pool->free_list = NULL;
+    pool->used_in_slab = pool->objects_per_slab;
+}
 
-        for (int i = 0; i < num_auto; i++) {
-            // Inserisce la nuova auto alla fine del heap
-            heap->size++;
-            int j = heap->size - 1;
-            heap->array_auto[j] = autonomies[i];
+void* arena_alloc(Arena* arena, size_t bytes) {
+    bytes = (bytes + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
 
-            // Sposta la nuova auto alla posizione corretta nel heap
-            while (j != 0 && heap->array_auto[(j - 1) / 2] < heap->array_auto[j]) {
-                int temp = heap->array_auto[j];
-                heap->array_auto[j] = heap->array_auto[(j - 1) / 2];
-                heap->array_auto[(j - 1) / 2] = temp;
-                j = (j - 1) / 2;
-            }
+    ArenaBlock* block = arena->block;
+    if (block == NULL || block->size - block->used < bytes) {
+        // Ogni nuovo blocco  almeno il doppio del precedente
+        size_t size = block != NULL ? block->size * 2 : ARENA_MIN_BYTES;
+        while (size < bytes) {
+            size *= 2;
         }
 
-    } else {
-        if (distance < root->distance) {
-            root->left = add_car(root->left, distance, num_auto, autonomies, is_station_added);
-        } else if (distance > root->distance) {
-            root->right = add_car(root->right, distance, num_auto, autonomies, is_station_added);
-        } else {
-            *is_station_added = 0;
-            return root;
+        ArenaBlock* new_block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + size);
+        if (new_block == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
         }
+        new_block->previous = block;
+        new_block->size = size;
+        new_block->used = 0;
+        arena->block = block = new_block;
     }
 
-    return root;
+    void* memory = (char*)(block + 1) + block->used;
+    block->used += bytes;
+    return memory;
 }
 
-void resize_min_heap(MinHeap* heap) {
-    heap->capacity *= 2;
-    heap->array = realloc(heap->array, heap->capacity * sizeof(MinHeapNode*));
-    if (heap->array == NULL) {
-        // Gestisci l'errore di allocazione della memoria, ad esempio terminando il programma
-        printf("Memory allocation failed\n");
-        exit(1);
+// Libera in un passo tutta la memoria della query: resta solo il blocco pi grande,
+// che dopo le prime query basta da solo e rende l'azzeramento O(1)
+void arena_reset(Arena* arena) {
+    ArenaBlock* block = arena->block;
+    if (block == NULL) {
+        return;
     }
-}
 
-void insert_in_minHeap(MinHeap* heap, BSTNode* bst_node, int distance, int sum_distances_from_zero) {
-    // Controlla se il heap  pieno e, in tal caso, ridimensiona
-    if (heap->size == heap->capacity) {
-        resize_min_heap(heap);
+    while (block->previous != NULL) {
+        ArenaBlock* previous = block->previous->previous;
+        free(block->previous);
+        block->previous = previous;
     }
+    block->used = 0;
+}
+
+void free_arena(Arena* arena) {
+    arena_reset(arena);
+    free(arena->block);
+    arena->block = NULL;
+}
 
-    MinHeapNode* new_heap_node = (MinHeapNode*)malloc(sizeof(MinHeapNode));
-    if (new_heap_node == NULL) {
-        // Gestisci l'errore di allocazione della memoria
+void output_init(OutputBuffer* out, int fd) {
+    out->fd = fd;
+    out->closed = false;
+    out->pipeline = NULL;
+    out->length = 0;
+    out->capacity = OUTPUT_BLOCK_SIZE;
+    out->data = (char*)malloc(out->capacity);
+    if (out->data == NULL) {
         printf("Memory allocation failed\n");
         exit(1);
     }
+}
 
-    new_heap_node->bst_node = bst_node;
-    new_heap_node->distance_dijkstra = distance;
-    new_heap_node->sum_distances_from_zero = sum_distances_from_zero;
-
-    heap->array[heap->size] = new_heap_node;
-    heap->size++;
-
-    int idx = heap->size - 1;
-    while (idx) {
-        int parent_idx = (idx - 1) / 2;
-        if (heap->array[idx]->distance_dijkstra < heap->array[parent_idx]->distance_dijkstra ||
-            (heap->array[idx]->distance_dijkstra == heap->array[parent_idx]->distance_dijkstra &&
-             heap->array[idx]->sum_distances_from_zero < heap->array[parent_idx]->sum_distances_from_zero)) {
-            // Swap
-            MinHeapNode* temp = heap->array[idx];
-            heap->array[idx] = heap->array[parent_idx];
-            heap->array[parent_idx] = temp;
-            idx = parent_idx;
-        } else {
-            break;
+bool write_all(int fd, const char* data, size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = write(fd, data + written, length - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
         }
+        written += n;
     }
+    return true;
 }
 
-void min_heapify(MinHeap* heap, int idx) {
-    int smallest = idx;
-    int left = 2 * idx + 1;
-    int right = 2 * idx + 2;
+void pipeline_send_output(Pipeline* pipeline, OutputBuffer* out);
 
-    // Utilizzare il nuovo campo nel confronto
-    if (left < heap->size) {
-        if (heap->array[left]->distance_dijkstra < heap->array[smallest]->distance_dijkstra ||
-            (heap->array[left]->distance_dijkstra == heap->array[smallest]->distance_dijkstra &&
-             heap->array[left]->sum_distances_from_zero < heap->array[smallest]->sum_distances_from_zero)) {
-            smallest = left;
+void output_flush(OutputBuffer* out) {
+    if (out->pipeline != NULL) {
+        if (out->length > 0) {
+            pipeline_send_output(out->pipeline, out);
         }
+        return;
+    }
+    if (out->fd < 0) {
+        return;
     }
 
-    if (right < heap->size) {
-        if (heap->array[right]->distance_dijkstra < heap->array[smallest]->distance_dijkstra ||
-            (heap->array[right]->distance_dijkstra == heap->array[smallest]->distance_dijkstra &&
-             heap->array[right]->sum_distances_from_zero < heap->array[smallest]->sum_distances_from_zero)) {
-            smallest = right;
+    if (!out->closed && !write_all(out->fd, out->data, out->length)) {
+        // Solo un client del server pu andarsene: SIGPIPE  ignorato l
+        if (errno != EPIPE && errno != ECONNRESET) {
+            exit(1);
         }
+        out->closed = true;
     }
+    out->length = 0;
+}
 
-    if (smallest != idx) {
-        // Swap the nodes
-        MinHeapNode* temp = heap->array[smallest];
-        heap->array[smallest] = heap->array[idx];
-        heap->array[idx] = temp;
+void output_free(OutputBuffer* out) {
+    output_flush(out);
+    free(out->data);
+    out->data = NULL;
+    out->capacity = 0;
+}
 
-        min_heapify(heap, smallest);
+// Garantisce spazio per altri bytes byte, svuotando il buffer o facendolo crescere
+void output_reserve(OutputBuffer* out, size_t bytes) {
+    if (out->capacity - out->length >= bytes) {
+        return;
     }
-}
 
-void resize_down_min_heap(MinHeap* heap) {
-    heap->capacity /= 2;
-    heap->array = (MinHeapNode**)realloc(heap->array, heap->capacity * sizeof(MinHeapNode*));
-    if (heap->array == NULL) {
-        // Gestisci l'errore di allocazione della memoria, ad esempio terminando il programma
-        printf("Memory allocation failed\n");
-        exit(1);
+    if (out->fd >= 0 || out->pipeline != NULL) {
+        output_flush(out);
+    }
+    if (out->capacity - out->length < bytes) {
+        while (out->capacity - out->length < bytes) {
+            out->capacity *= 2;
+        }
+        out->data = (char*)realloc(out->data, out->capacity);
+        if (out->data == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
     }
 }
 
-MinHeapNode* extract_min(MinHeap* heap) {
-    if (heap->size == 0) return NULL;
+void output_bytes(OutputBuffer* out, const char* bytes, size_t length) {
+    output_reserve(out, length);
+    memcpy(out->data + out->length, bytes, length);
+    out->length += length;
+}
 
-    MinHeapNode* root = heap->array[0];
-    heap->array[0] = heap->array[heap->size - 1];
-    heap->size--;
-    min_heapify(heap, 0);
+void output_string(OutputBuffer* out, const char* string) {
+    output_bytes(out, string, strlen(string));
+}
 
-    return root;
+void output_char(OutputBuffer* out, char c) {
+    output_reserve(out, 1);
+    out->data[out->length++] = c;
 }
 
-void decrease_key(MinHeap* heap, BSTNode* bst_node, int distance) {
-    // Find the node's index in the heap array
-    int i;
-    for (i = 0; i < heap->size; i++) {
-        if (heap->array[i]->bst_node == bst_node) break;
-    }
+void output_int(OutputBuffer* out, int value) {
+    char digits[12];
+    int n = 0;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
 
-    // Update the distance and sum of distances to zero
-    heap->array[i]->distance_dijkstra = distance;
-    heap->array[i]->bst_node->sum_distances_from_zero = bst_node->sum_distances_from_zero;
+    do {
+        digits[n++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
 
-    // Move the updated node up the heap to maintain the heap property
-    while (i && (heap->array[i]->distance_dijkstra < heap->array[(i - 1) / 2]->distance_dijkstra ||
-                 (heap->array[i]->distance_dijkstra == heap->array[(i - 1) / 2]->distance_dijkstra &&
-                  heap->array[i]->bst_node->sum_distances_from_zero < heap->array[(i - 1) / 2]->bst_node->sum_distances_from_zero))) {
-        // Swap
-        MinHeapNode* temp = heap->array[i];
-        heap->array[i] = heap->array[(i - 1) / 2];
-        heap->array[(i - 1) / 2] = temp;
-        i = (i - 1) / 2;
+    output_reserve(out, n + 1);
+    if (value < 0) {
+        out->data[out->length++] = '-';
+    }
+    while (n > 0) {
+        out->data[out->length++] = digits[--n];
     }
 }
 
-int is_in_heap(MinHeap* heap, BSTNode* bst_node) {
-    for (int i = 0; i < heap->size; i++) {
-        if (heap->array[i]->bst_node == bst_node) {
-            return 1;  // True
-        }
+void init_station_index(StationIndex* index) {
+    index->root = NULL;
+    index->size = 0;
+    index->route_version = 0;
+    memset(&index->jump, 0, sizeof(JumpIndex));
+    memset(&index->array, 0, sizeof(StationArray));
+    init_slab_allocator(&index->station_pool, sizeof(Station));
+    init_slab_allocator(&index->node_pool, sizeof(BTreeNode));
+    for (int c = 0; c < FLEET_SIZE_CLASSES; c++) {
+        init_slab_allocator(&index->fleet_pools[c], (FLEET_INLINE_SLOTS << (c + 1)) * sizeof(AutoCount));
     }
-    return 0;  // False
 }
 
-bool isInInterval(int a, int b, int c) {
-    if (b == a || b == c) {
-        return true;
-    }
+// Registra una modifica che pu cambiare i percorsi passanti per distance
+void record_route_change(StationIndex* index, int distance, bool endpoint) {
+    index->route_version++;
+    RouteChange* change = &index->route_changes[index->route_version % ROUTE_CHANGE_LOG_SIZE];
+    change->distance = distance;
+    change->endpoint = endpoint;
+}
 
-    if (a < c) {
-        return b > a && b < c;
-    } else {
-        return b > c && b < a;
+Station* create_station(StationIndex* index, int distance) {
+    Station* new_node = (Station*)slab_alloc(&index->station_pool);
+
+    new_node->distance = distance;
+    new_node->fleet.size = 0;
+    new_node->fleet.capacity = FLEET_INLINE_SLOTS;
+
+    // Inizializzazione dei campi per Dijkstra
+    new_node->distance_dijkstra = LLONG_MAX;
+    new_node->sum_distances_from_zero = 0;
+    new_node->prev = NULL;
+    new_node->heap_index = -1;
+    new_node->search_epoch = 0;
+
+    return new_node;
+}
+
+BTreeNode* create_btree_node(StationIndex* index, bool is_leaf) {
+    BTreeNode* node = (BTreeNode*)slab_alloc(&index->node_pool);
+
+    node->is_leaf = is_leaf;
+    node->num_keys = 0;
+    node->next = NULL;
+
+    return node;
+}
+
+// Numero di chiavi del nodo strettamente minori di distance
+int node_lower_bound(const BTreeNode* node, int distance) {
+    int lo = 0, hi = node->num_keys;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (node->keys[mid] < distance) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
+    return lo;
 }
 
-void traverse_to_update_adjacent(BSTNode* node, BSTNode* station, MinHeap* min_heap, int dest, int src) {
-    if (!node) {
-        return;
+// Numero di chiavi del nodo minori o uguali a distance (indice del figlio da seguire)
+int node_upper_bound(const BTreeNode* node, int distance) {
+    int lo = 0, hi = node->num_keys;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (node->keys[mid] <= distance) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
+    return lo;
+}
 
-    int max_autonomy = get_max_autonomy_auto(station->auto_heap);
+Station* search_station(StationIndex* index, int distance) {
+    BTreeNode* node = index->root;
 
-    bool ok_ricerca;
-    ok_ricerca = isInInterval(dest, node->distance, src);
+    // Caso base: l'albero  vuoto
+    if (node == NULL) {
+        return NULL;
+    }
 
-    if(ok_ricerca && max_autonomy != -1) {
-        int distance = abs(station->distance - node->distance);
-        if (distance <= max_autonomy) {
-            int nuova_distance = station->distance_dijkstra + distance;
-            int nuova_sum_distances_from_zero = station->sum_distances_from_zero + node->distance;
-
-            if (nuova_distance < node->distance_dijkstra ||
-                (nuova_distance == node->distance_dijkstra && nuova_sum_distances_from_zero < node->sum_distances_from_zero)) {
-                node->distance_dijkstra = nuova_distance;
-                node->sum_distances_from_zero = nuova_sum_distances_from_zero;
-                if(node->distance != station->distance) {
-                    node->prev = station;
-                }
+    // Scende fino alla foglia che pu contenere la stazione
+    STATS_INC(tree_descents);
+    while (!node->is_leaf) {
+        STATS_INC(tree_nodes_visited);
+        node = node->children[node_upper_bound(node, distance)];
+    }
+    STATS_INC(tree_nodes_visited);
 
-                // Se il nodo non  gi nel Min Heap, inseriscilo
-                if (!is_in_heap(min_heap, node)) {
-                    insert_in_minHeap(min_heap, node, nuova_distance, nuova_sum_distances_from_zero);
-                } else {
-                    // Altrimenti, aggiorna il nodo nella coda di priorit
-                    decrease_key(min_heap, node, nuova_distance);
-                }
-            }
-        }
+    int i = node_lower_bound(node, distance);
+    if (i < node->num_keys && node->keys[i] == distance) {
+        return node->stations[i];
     }
 
-    traverse_to_update_adjacent(node->left, station, min_heap, dest, src);
-    traverse_to_update_adjacent(node->right, station, min_heap, dest, src);
+    return NULL;
 }
 
-void update_adjacent_stations(BSTNode* current_bst_node, BSTNode* root, MinHeap* min_heap, int dest, int src) {
-    traverse_to_update_adjacent(root, current_bst_node, min_heap, dest, src);
-}
+// Cursore sulla prima stazione con distanza >= distance
+StationCursor station_lower_bound(StationIndex* index, int distance) {
+    StationCursor it = { index->root, 0 };
 
-MinHeap* create_min_heap(int capacity) {
-    MinHeap* heap = (MinHeap*)malloc(sizeof(MinHeap));
-    if (heap == NULL) {
-        printf("Memory allocation failed for MinHeap structure\n");
-        exit(1);
+    if (it.leaf == NULL) {
+        return it;
     }
 
-    heap->array = (MinHeapNode**)malloc(capacity * sizeof(MinHeapNode*));
-    if (heap->array == NULL) {
-        printf("Memory allocation failed for MinHeap array\n");
-        free(heap);  // Libera la memoria gi allocata per la struttura heap
-        exit(1);
+    STATS_INC(tree_descents);
+    while (!it.leaf->is_leaf) {
+        STATS_INC(tree_nodes_visited);
+        it.leaf = it.leaf->children[node_upper_bound(it.leaf, distance)];
     }
+    STATS_INC(tree_nodes_visited);
 
-    heap->size = 0;
-    heap->capacity = capacity;
+    it.pos = node_lower_bound(it.leaf, distance);
+    if (it.pos == it.leaf->num_keys) {
+        it.leaf = it.leaf->next;
+        it.pos = 0;
+    }
 
-    return heap;
+    return it;
 }
 
+StationCursor station_first(StationIndex* index) {
+    return station_lower_bound(index, INT_MIN);
+}
 
-void dijkstra_adattato(BSTNode* root, int dest, int src) {
-    if (root == NULL) return;
+// Stazione puntata dal cursore, NULL se la visita  terminata
+Station* station_cursor_get(const StationCursor* it) {
+    if (it->leaf == NULL) {
+        return NULL;
+    }
+    return it->leaf->stations[it->pos];
+}
 
-    // Inizializzazione
-    MinHeap* min_heap = create_min_heap(MIN_HEAP_CAPACITY);  // Inizializza con una capacit arbitraria
-    BSTNode* dest_node = search_station(root, dest);
-    if (dest_node == NULL) return;
-    dest_node->distance_dijkstra = 0;
+void station_cursor_next(StationCursor* it) {
+    it->pos++;
+    if (it->pos == it->leaf->num_keys) {
+        it->leaf = it->leaf->next;
+        it->pos = 0;
+    }
+}
 
-    MinHeapNode* new_heap_node = (MinHeapNode*)malloc(sizeof(MinHeapNode));
-    new_heap_node->bst_node = dest_node;
-    new_heap_node->distance_dijkstra = 0;
-    min_heap->array[0] = new_heap_node;
-    min_heap->size = 1;
+// Epoca della query corrente di dijkstra_adattato: i campi di ricerca di una stazione
+// con un'epoca diversa sono considerati ancora da inizializzare
+unsigned int dijkstra_epoch = 0;
 
-    while (min_heap->size != 0) {
-        MinHeapNode* current_heap_node = extract_min(min_heap);
-        BSTNode* current_bst_node = current_heap_node->bst_node;
+// Avvia una nuova query in O(1) invalidando lo stato di tutte le stazioni
+void begin_dijkstra_query(StationIndex* index) {
+    dijkstra_epoch++;
 
-        // Se il nodo corrente  il nodo di arrivo, interrompi l'algoritmo.
-        if (current_bst_node->distance == src) {
-            free(current_heap_node);
-            break;
+    // Al ritorno a zero del contatore le epoche vecchie potrebbero sembrare valide
+    if (dijkstra_epoch == 0) {
+        Station* node;
+        for (StationCursor it = station_first(index); (node = station_cursor_get(&it)) != NULL; station_cursor_next(&it)) {
+            node->search_epoch = 0;
         }
+        dijkstra_epoch = 1;
+    }
+}
 
-        // Per ogni stazione adiacente...
-        update_adjacent_stations(current_bst_node, root, min_heap, dest, src);
+// Inizializza i campi di ricerca della stazione alla prima visita della query corrente
+void touch_station(Station* node) {
+    if (node->search_epoch != dijkstra_epoch) {
+        node->search_epoch = dijkstra_epoch;
+        node->distance_dijkstra = LLONG_MAX;
+        node->sum_distances_from_zero = 0;
+        node->prev = NULL;
+        node->heap_index = -1;
+    }
+}
+
+int get_max_autonomy_auto(Fleet* fleet);
+
+// Autonomia che entra nei reach dell'albero: una stazione senza auto copre solo se stessa
+int32_t station_autonomy(Station* station) {
+    int autonomy = get_max_autonomy_auto(&station->fleet);
+    return autonomy > 0 ? autonomy : 0;
+}
 
-        free(current_heap_node);  // Libera la memoria del nodo estratto
+// Intervallo coperto da tutte le stazioni del nodo
+void btree_node_reach(const BTreeNode* node, int32_t* reach_min, int32_t* reach_max) {
+    long long lo = LLONG_MAX, hi = LLONG_MIN;
+    if (node->is_leaf) {
+        for (int k = 0; k < node->num_keys; k++) {
+            long long from = (long long)node->keys[k] - node->autonomy[k];
+            long long to = (long long)node->keys[k] + node->autonomy[k];
+            lo = from < lo ? from : lo;
+            hi = to > hi ? to : hi;
+        }
+    } else {
+        for (int c = 0; c <= node->num_keys; c++) {
+            lo = node->reach_min[c] < lo ? node->reach_min[c] : lo;
+            hi = node->reach_max[c] > hi ? node->reach_max[c] : hi;
+        }
     }
+    // Un nodo vuoto non copre niente; i limiti di int32_t bastano per i confronti
+    *reach_min = lo > INT32_MAX ? INT32_MAX : lo < INT32_MIN ? INT32_MIN : (int32_t)lo;
+    *reach_max = hi < INT32_MIN ? INT32_MIN : hi > INT32_MAX ? INT32_MAX : (int32_t)hi;
+}
 
-    // Libera la memoria del min_heap
-    for (int i = 0; i < min_heap->size; i++) {
-        free(min_heap->array[i]);
+// Ricalcola la voce del figlio c; restituisce false se non  cambiata
+bool btree_refresh_child(BTreeNode* parent, int c) {
+    int32_t reach_min, reach_max;
+    btree_node_reach(parent->children[c], &reach_min, &reach_max);
+    if (reach_min == parent->reach_min[c] && reach_max == parent->reach_max[c]) {
+        return false;
     }
-    free(min_heap->array);
-    free(min_heap);
+    parent->reach_min[c] = reach_min;
+    parent->reach_max[c] = reach_max;
+    return true;
 }
 
-void stampa_percorso(BSTNode* node) {
-    if (!node) return;
-    printf("%d", node->distance);
-    if (node->prev) {
-        printf(" ");
+// La voce del figlio c dopo che nel sottoalbero  comparso l'intervallo [from, to]:
+// basta allargarla. Restituisce false se non  cambiata.
+bool btree_widen_child(BTreeNode* parent, int c, long long from, long long to) {
+    bool changed = false;
+    if (from < parent->reach_min[c]) {
+        parent->reach_min[c] = from < INT32_MIN ? INT32_MIN : (int32_t)from;
+        changed = true;
     }
-    stampa_percorso(node->prev);
+    if (to > parent->reach_max[c]) {
+        parent->reach_max[c] = to > INT32_MAX ? INT32_MAX : (int32_t)to;
+        changed = true;
+    }
+    return changed;
 }
 
-void forward_percorso(BSTNode* node) {
-    if (!node) return;
-    forward_percorso(node->prev);
-    if (node->prev) {
-        printf(" ");
+// La voce del figlio c dopo che dal sottoalbero  sparito l'intervallo [from, to]:
+// se era strettamente all'interno la voce non cambia, altrimenti si ricalcola
+bool btree_shrink_child(BTreeNode* parent, int c, long long from, long long to) {
+    if (from > parent->reach_min[c] && to < parent->reach_max[c]) {
+        return false;
     }
-    printf("%d", node->distance);
+    return btree_refresh_child(parent, c);
 }
 
-void pianifica_percorso(BSTNode* root, int dest, int src) {
-    bool isForward = false ;
-    if(src == dest)
-    {
-    	printf("%d \n", src);
-	}
-	if(dest>src)
-	{
-	    int temp = dest ;
-	    dest = src ;
-	    src = temp ;
-	    isForward = true ;
-	}
-    reset_dijkstra_values(root);
-    dijkstra_adattato(root, dest, src);
-    // Ottieni il nodo di destinazione
-    BSTNode* src_node = search_station(root, src);
-    if (!src_node || src_node->distance_dijkstra == INT_MAX) {
-        printf("nessun percorso\n");
-    } else {
-        if(isForward)
-        {
-            forward_percorso(src_node);
-            printf("\n");
+// Ricalcola tutte le voci del nodo dalle stazioni o dai figli, gi aggiornati.
+// Serve dopo divisioni, fusioni e prestiti, che spostano molte voci insieme.
+void btree_rebuild_reach(BTreeNode* node) {
+    if (node->is_leaf) {
+        for (int k = 0; k < node->num_keys; k++) {
+            node->autonomy[k] = station_autonomy(node->stations[k]);
         }
-        else
-        {
-            stampa_percorso(src_node);
-            printf("\n");
+    } else {
+        for (int c = 0; c <= node->num_keys; c++) {
+            btree_refresh_child(node, c);
         }
     }
 }
 
-void free_bst(BSTNode* root) {
-    if (root != NULL) {
-        // Libera la memoria dei sottoalberi sinistro e destro
-        free_bst(root->left);
-        free_bst(root->right);
+// Inserisce una nuova stazione nel sottoalbero. In *inserted restituisce la stazione
+// creata (NULL se la distanza  gi presente); se il nodo viene diviso restituisce il
+// nuovo fratello destro e in *separator la sua chiave separatrice.
+BTreeNode* btree_insert(StationIndex* index, BTreeNode* node, int distance, Station** inserted, int* separator) {
+    int keys[BTREE_MAX_KEYS + 1];
 
-        if (root->auto_heap != NULL) {
-            free(root->auto_heap);
+    STATS_INC(tree_nodes_visited);
+
+    if (node->is_leaf) {
+        int i = node_lower_bound(node, distance);
+        if (i < node->num_keys && node->keys[i] == distance) {
+            *inserted = NULL;
+            return NULL;
         }
 
-        // Libera la memoria del nodo
-        free(root);
-    }
-}
+        *inserted = create_station(index, distance);
 
-int main() {
-    char comando[20];
-    BSTNode* root = NULL;
+        if (node->num_keys < BTREE_MAX_KEYS) {
+            memmove(&node->keys[i + 1], &node->keys[i], (node->num_keys - i) * sizeof(int));
+            memmove(&node->stations[i + 1], &node->stations[i], (node->num_keys - i) * sizeof(Station*));
+            memmove(&node->autonomy[i + 1], &node->autonomy[i], (node->num_keys - i) * sizeof(int32_t));
+            node->keys[i] = distance;
+            node->stations[i] = *inserted;
+            node->autonomy[i] = 0;
+            node->num_keys++;
+            return NULL;
+        }
 
-    while (scanf("%s", comando) != EOF) {
-        if (strcmp(comando, "aggiungi-stazione") == 0) {
-            int distanza, numero_auto;
+        // Foglia piena: unisce le chiavi in un buffer temporaneo e le divide a met
+        Station* stations[BTREE_MAX_KEYS + 1];
+        memcpy(keys, node->keys, i * sizeof(int));
+        memcpy(stations, node->stations, i * sizeof(Station*));
+        keys[i] = distance;
+        stations[i] = *inserted;
+        memcpy(&keys[i + 1], &node->keys[i], (BTREE_MAX_KEYS - i) * sizeof(int));
+        memcpy(&stations[i + 1], &node->stations[i], (BTREE_MAX_KEYS - i) * sizeof(Station*));
 
+        int left_size = (BTREE_MAX_KEYS + 1) / 2;
+        int right_size = BTREE_MAX_KEYS + 1 - left_size;
+        BTreeNode* right = create_btree_node(index, true);
 
-            if (scanf("%d %d", &distanza, &numero_auto) != 2) {
-                printf("Errore di input\n");
-                break;
-            }
+        memcpy(node->keys, keys, left_size * sizeof(int));
+        memcpy(node->stations, stations, left_size * sizeof(Station*));
+        node->num_keys = left_size;
+        memcpy(right->keys, &keys[left_size], right_size * sizeof(int));
+        memcpy(right->stations, &stations[left_size], right_size * sizeof(Station*));
+        right->num_keys = right_size;
 
-            int autonomie[numero_auto];
+        right->next = node->next;
+        node->next = right;
+        btree_rebuild_reach(node);
+        btree_rebuild_reach(right);
 
-            for (int i = 0; i < numero_auto; i++) {
-                if (scanf("%d", &autonomie[i]) != 1) {
-                    printf("Errore di input\n");
-                    break;
+        *separator = right->keys[0];
+        return right;
+    }
+
+    int c = node_upper_bound(node, distance);
+    int child_separator;
+    BTreeNode* new_child = btree_insert(index, node->children[c], distance, inserted, &child_separator);
+
+    if (new_child == NULL) {
+        // La nuova stazione non ha ancora auto
+        if (*inserted != NULL) {
+            btree_widen_child(node, c, distance, distance);
+        }
+        return NULL;
+    }
+
+    if (node->num_keys < BTREE_MAX_KEYS) {
+        memmove(&node->keys[c + 1], &node->keys[c], (node->num_keys - c) * sizeof(int));
+        memmove(&node->children[c + 2], &node->children[c + 1], (node->num_keys - c) * sizeof(BTreeNode*));
+        memmove(&node->reach_min[c + 2], &node->reach_min[c + 1], (node->num_keys - c) * sizeof(int32_t));
+        memmove(&node->reach_max[c + 2], &node->reach_max[c + 1], (node->num_keys - c) * sizeof(int32_t));
+        node->keys[c] = child_separator;
+        node->children[c + 1] = new_child;
+        node->num_keys++;
+        btree_refresh_child(node, c);
+        btree_refresh_child(node, c + 1);
+        return NULL;
+    }
+
+    // Nodo interno pieno: la chiave centrale sale al padre
+    BTreeNode* children[BTREE_MAX_KEYS + 2];
+    memcpy(keys, node->keys, c * sizeof(int));
+    memcpy(children, node->children, (c + 1) * sizeof(BTreeNode*));
+    keys[c] = child_separator;
+    children[c + 1] = new_child;
+    memcpy(&keys[c + 1], &node->keys[c], (BTREE_MAX_KEYS - c) * sizeof(int));
+    memcpy(&children[c + 2], &node->children[c + 1], (BTREE_MAX_KEYS - c) * sizeof(BTreeNode*));
+
+    int left_size = (BTREE_MAX_KEYS + 1) / 2;
+    int right_size = BTREE_MAX_KEYS - left_size;
+    BTreeNode* right = create_btree_node(index, false);
+
+    memcpy(node->keys, keys, left_size * sizeof(int));
+    memcpy(node->children, children, (left_size + 1) * sizeof(BTreeNode*));
+    node->num_keys = left_size;
+    memcpy(right->keys, &keys[left_size + 1], right_size * sizeof(int));
+    memcpy(right->children, &children[left_size + 1], (right_size + 1) * sizeof(BTreeNode*));
+    right->num_keys = right_size;
+    btree_rebuild_reach(node);
+    btree_rebuild_reach(right);
+
+    *separator = keys[left_size];
+    return right;
+}
+
+// Unisce il figlio c + 1 nel figlio c e rimuove la chiave separatrice dal padre
+void btree_merge_children(StationIndex* index, BTreeNode* parent, int c) {
+    BTreeNode* left = parent->children[c];
+    BTreeNode* right = parent->children[c + 1];
+
+    if (left->is_leaf) {
+        memcpy(&left->keys[left->num_keys], right->keys, right->num_keys * sizeof(int));
+        memcpy(&left->stations[left->num_keys], right->stations, right->num_keys * sizeof(Station*));
+        left->num_keys += right->num_keys;
+        left->next = right->next;
+    } else {
+        left->keys[left->num_keys] = parent->keys[c];
+        memcpy(&left->keys[left->num_keys + 1], right->keys, right->num_keys * sizeof(int));
+        memcpy(&left->children[left->num_keys + 1], right->children, (right->num_keys + 1) * sizeof(BTreeNode*));
+        left->num_keys += right->num_keys + 1;
+    }
+    btree_rebuild_reach(left);
+
+    slab_free(&index->node_pool, right);
+
+    memmove(&parent->keys[c], &parent->keys[c + 1], (parent->num_keys - c - 1) * sizeof(int));
+    memmove(&parent->children[c + 1], &parent->children[c + 2], (parent->num_keys - c - 1) * sizeof(BTreeNode*));
+    parent->num_keys--;
+}
+
+// Riporta il figlio c sopra il numero minimo di chiavi prendendo in prestito
+// una chiave da un fratello oppure unendolo a uno dei fratelli
+void btree_fix_child(StationIndex* index, BTreeNode* parent, int c) {
+    BTreeNode* child = parent->children[c];
+
+    if (c > 0 && parent->children[c - 1]->num_keys > BTREE_MIN_KEYS) {
+        BTreeNode* left = parent->children[c - 1];
+
+        memmove(&child->keys[1], child->keys, child->num_keys * sizeof(int));
+        if (child->is_leaf) {
+            memmove(&child->stations[1], child->stations, child->num_keys * sizeof(Station*));
+            child->keys[0] = left->keys[left->num_keys - 1];
+            child->stations[0] = left->stations[left->num_keys - 1];
+            parent->keys[c - 1] = child->keys[0];
+        } else {
+            memmove(&child->children[1], child->children, (child->num_keys + 1) * sizeof(BTreeNode*));
+            child->keys[0] = parent->keys[c - 1];
+            child->children[0] = left->children[left->num_keys];
+            parent->keys[c - 1] = left->keys[left->num_keys - 1];
+        }
+        child->num_keys++;
+        left->num_keys--;
+        btree_rebuild_reach(child);
+        btree_rebuild_reach(left);
+    } else if (c < parent->num_keys && parent->children[c + 1]->num_keys > BTREE_MIN_KEYS) {
+        BTreeNode* right = parent->children[c + 1];
+
+        if (child->is_leaf) {
+            child->keys[child->num_keys] = right->keys[0];
+            child->stations[child->num_keys] = right->stations[0];
+            memmove(right->stations, &right->stations[1], (right->num_keys - 1) * sizeof(Station*));
+            memmove(right->keys, &right->keys[1], (right->num_keys - 1) * sizeof(int));
+            parent->keys[c] = right->keys[0];
+        } else {
+            child->keys[child->num_keys] = parent->keys[c];
+            child->children[child->num_keys + 1] = right->children[0];
+            parent->keys[c] = right->keys[0];
+            memmove(right->keys, &right->keys[1], (right->num_keys - 1) * sizeof(int));
+            memmove(right->children, &right->children[1], right->num_keys * sizeof(BTreeNode*));
+        }
+        child->num_keys++;
+        right->num_keys--;
+        btree_rebuild_reach(child);
+        btree_rebuild_reach(right);
+    } else if (c > 0) {
+        btree_merge_children(index, parent, c - 1);
+    } else {
+        btree_merge_children(index, parent, c);
+    }
+}
+
+// Rimuove la stazione dal sottoalbero e la restituisce (NULL se non presente)
+Station* btree_remove(StationIndex* index, BTreeNode* node, int distance) {
+    STATS_INC(tree_nodes_visited);
+    if (node->is_leaf) {
+        int i = node_lower_bound(node, distance);
+        if (i == node->num_keys || node->keys[i] != distance) {
+            return NULL;
+        }
+
+        Station* removed = node->stations[i];
+        memmove(&node->keys[i], &node->keys[i + 1], (node->num_keys - i - 1) * sizeof(int));
+        memmove(&node->stations[i], &node->stations[i + 1], (node->num_keys - i - 1) * sizeof(Station*));
+        memmove(&node->autonomy[i], &node->autonomy[i + 1], (node->num_keys - i - 1) * sizeof(int32_t));
+        node->num_keys--;
+        return removed;
+    }
+
+    int c = node_upper_bound(node, distance);
+    Station* removed = btree_remove(index, node->children[c], distance);
+
+    if (removed != NULL) {
+        if (node->children[c]->num_keys < BTREE_MIN_KEYS) {
+            btree_fix_child(index, node, c);
+            btree_rebuild_reach(node);
+        } else {
+            int32_t autonomy = station_autonomy(removed);
+            btree_shrink_child(node, c, (long long)distance - autonomy, (long long)distance + autonomy);
+        }
+    }
+
+    return removed;
+}
+
+// Costruisce il B+tree dal basso a partire da stazioni ordinate per distanza, senza
+// discese: le foglie vengono riempite in modo uniforme e ogni livello raccoglie i
+// nodi di quello sottostante. Con pi di un nodo per livello ognuno riceve almeno
+// met delle chiavi, quindi i vincoli di btree_remove sono rispettati.
+// L'indice deve essere vuoto.
+void btree_bulk_build(StationIndex* index, Station** stations, int count) {
+    if (count == 0) {
+        return;
+    }
+
+    int size = (count + BTREE_MAX_KEYS - 1) / BTREE_MAX_KEYS;
+    BTreeNode** level = (BTreeNode**)malloc(size * sizeof(BTreeNode*));
+    int* lowest = (int*)malloc(size * sizeof(int));  // Chiave minima di ogni sottoalbero
+    if (level == NULL || lowest == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+
+    BTreeNode* previous = NULL;
+    int pos = 0;
+    for (int l = 0; l < size; l++) {
+        int take = count / size + (l < count % size ? 1 : 0);
+        BTreeNode* leaf = create_btree_node(index, true);
+        for (int k = 0; k < take; k++, pos++) {
+            leaf->keys[k] = stations[pos]->distance;
+            leaf->stations[k] = stations[pos];
+        }
+        leaf->num_keys = take;
+        btree_rebuild_reach(leaf);
+        if (previous != NULL) {
+            previous->next = leaf;
+        }
+        previous = leaf;
+        level[l] = leaf;
+        lowest[l] = leaf->keys[0];
+    }
+
+    while (size > 1) {
+        int parents = (size + BTREE_MAX_KEYS) / (BTREE_MAX_KEYS + 1);
+        pos = 0;
+        for (int p = 0; p < parents; p++) {
+            int take = size / parents + (p < size % parents ? 1 : 0);
+            BTreeNode* node = create_btree_node(index, false);
+            for (int k = 0; k < take; k++) {
+                node->children[k] = level[pos + k];
+                if (k > 0) {
+                    node->keys[k - 1] = lowest[pos + k];
+                }
+            }
+            node->num_keys = take - 1;
+            btree_rebuild_reach(node);
+            // p <= pos: il livello superiore si scrive sopra a quello appena letto
+            lowest[p] = lowest[pos];
+            level[p] = node;
+            pos += take;
+        }
+        size = parents;
+    }
+
+    index->root = level[0];
+    index->size = count;
+    free(level);
+    free(lowest);
+}
+
+void delete_station(StationIndex* index, int distance, int* is_removed) {
+    // Caso base: l'albero  vuoto
+    if (index->root == NULL) {
+        *is_removed = 0;  // Imposta il flag per indicare che la stazione NON  stata rimossa
+        return;
+    }
+
+    STATS_INC(tree_descents);
+    Station* station = btree_remove(index, index->root, distance);
+    if (station == NULL) {
+        *is_removed = 0;  // Imposta il flag per indicare che la stazione NON  stata rimossa
+        return;
+    }
+
+    // Se la radice  rimasta senza chiavi l'albero si abbassa di un livello
+    BTreeNode* root = index->root;
+    if (root->num_keys == 0) {
+        index->root = root->is_leaf ? NULL : root->children[0];
+        slab_free(&index->node_pool, root);
+    }
+    index->size--;
+
+    fleet_release(index, &station->fleet);
+    slab_free(&index->station_pool, station);
+    record_route_change(index, distance, true);
+    *is_removed = 1;  // Imposta il flag per indicare che la stazione  stata rimossa
+}
+
+AutoCount* fleet_items(Fleet* fleet) {
+    return fleet->capacity > FLEET_INLINE_SLOTS ? fleet->items : fleet->inline_items;
+}
+
+// Classe di dimensione delle slab che contengono un array esterno di capacity voci
+int fleet_size_class(int capacity) {
+    int c = 0;
+    while ((FLEET_INLINE_SLOTS << (c + 1)) < capacity) {
+        c++;
+    }
+    if (c >= FLEET_SIZE_CLASSES) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    return c;
+}
+
+// Sposta le autonomie in un array della nuova capacit (interno se basta)
+void fleet_resize(StationIndex* index, Fleet* fleet, int new_capacity) {
+    AutoCount* old_items = fleet_items(fleet);
+    AutoCount* new_items;
+    AutoCount* heap_items = NULL;
+
+    if (new_capacity > FLEET_INLINE_SLOTS) {
+        heap_items = (AutoCount*)slab_alloc(&index->fleet_pools[fleet_size_class(new_capacity)]);
+        new_items = heap_items;
+    } else {
+        new_items = fleet->inline_items;
+    }
+
+    if (new_items != old_items) {
+        memmove(new_items, old_items, fleet->size * sizeof(AutoCount));
+    }
+    if (fleet->capacity > FLEET_INLINE_SLOTS) {
+        slab_free(&index->fleet_pools[fleet_size_class(fleet->capacity)], old_items);
+    }
+    if (heap_items != NULL) {
+        fleet->items = heap_items;
+    }
+    fleet->capacity = new_capacity;
+}
+
+void fleet_release(StationIndex* index, Fleet* fleet) {
+    if (fleet->capacity > FLEET_INLINE_SLOTS) {
+        slab_free(&index->fleet_pools[fleet_size_class(fleet->capacity)], fleet->items);
+    }
+    fleet->size = 0;
+    fleet->capacity = FLEET_INLINE_SLOTS;
+}
+
+// Posizione della prima autonomia distinta >= autonomy (ricerca binaria)
+int fleet_lower_bound(Fleet* fleet, int autonomy) {
+    AutoCount* items = fleet_items(fleet);
+    int lo = 0, hi = fleet->size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (items[mid].autonomy < autonomy) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void fleet_add(StationIndex* index, Fleet* fleet, int autonomy) {
+    int i = fleet_lower_bound(fleet, autonomy);
+    AutoCount* items = fleet_items(fleet);
+
+    if (i < fleet->size && items[i].autonomy == autonomy) {
+        items[i].count++;
+        return;
+    }
+
+    // Nuova autonomia distinta: la inserisce mantenendo l'ordine
+    if (fleet->size == fleet->capacity) {
+        fleet_resize(index, fleet, fleet->capacity * 2);
+        items = fleet_items(fleet);
+    }
+    memmove(&items[i + 1], &items[i], (fleet->size - i) * sizeof(AutoCount));
+    items[i].autonomy = autonomy;
+    items[i].count = 1;
+    fleet->size++;
+}
+
+// Rimuove un'auto con l'autonomia indicata; restituisce 0 se non esiste
+int fleet_remove(StationIndex* index, Fleet* fleet, int autonomy) {
+    int i = fleet_lower_bound(fleet, autonomy);
+    AutoCount* items = fleet_items(fleet);
+
+    if (i == fleet->size || items[i].autonomy != autonomy) {
+        return 0;
+    }
+
+    if (--items[i].count == 0) {
+        memmove(&items[i], &items[i + 1], (fleet->size - i - 1) * sizeof(AutoCount));
+        fleet->size--;
+
+        // Restituisce la memoria quando l'array esterno  quasi vuoto
+        if (fleet->capacity > FLEET_INLINE_SLOTS && fleet->size <= fleet->capacity / 4) {
+            int new_capacity = fleet->capacity / 2;
+            fleet_resize(index, fleet, new_capacity > FLEET_INLINE_SLOTS ? new_capacity : FLEET_INLINE_SLOTS);
+        }
+    }
+
+    return 1;
+}
+
+// Numero di auto con l'autonomia indicata
+int fleet_count(Fleet* fleet, int autonomy) {
+    int i = fleet_lower_bound(fleet, autonomy);
+    if (i == fleet->size || fleet_items(fleet)[i].autonomy != autonomy) {
+        return 0;
+    }
+    return fleet_items(fleet)[i].count;
+}
+
+// Porta la capacit del parco auto ad almeno size autonomie distinte
+void fleet_reserve(StationIndex* index, Fleet* fleet, int size) {
+    int capacity = FLEET_INLINE_SLOTS;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+    if (capacity > fleet->capacity) {
+        fleet_resize(index, fleet, capacity);
+    }
+}
+
+int compare_autonomies(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+int compare_auto_counts(const void* a, const void* b) {
+    return compare_autonomies(&((const AutoCount*)a)->autonomy, &((const AutoCount*)b)->autonomy);
+}
+
+// Riempie un parco auto vuoto in un solo passo contando le autonomie per valore:
+// una tabella hash sullo stack trova la voce di ogni autonomia e alla fine si
+// ordinano solo le voci distinte. Oltre FLEET_BUILD_MAX_AUTOS auto le autonomie
+// vengono ordinate sul posto e contate.
+void fleet_build(StationIndex* index, Fleet* fleet, int* autonomies, int count) {
+    if (count == 0) {
+        return;
+    }
+
+    if (count > FLEET_BUILD_MAX_AUTOS) {
+        qsort(autonomies, count, sizeof(int), compare_autonomies);
+        int distinct = 1;
+        for (int i = 1; i < count; i++) {
+            distinct += autonomies[i] != autonomies[i - 1];
+        }
+        fleet_reserve(index, fleet, distinct);
+
+        AutoCount* items = fleet_items(fleet);
+        int size = 0;
+        for (int i = 0; i < count; i++) {
+            if (size > 0 && items[size - 1].autonomy == autonomies[i]) {
+                items[size - 1].count++;
+            } else {
+                items[size].autonomy = autonomies[i];
+                items[size].count = 1;
+                size++;
+            }
+        }
+        fleet->size = size;
+        return;
+    }
+
+    // Tabella almeno doppia delle auto, quindi mai piena oltre met
+    AutoCount distinct[FLEET_BUILD_MAX_AUTOS];
+    int table[2 * FLEET_BUILD_MAX_AUTOS];  // Indice in distinct + 1, 0 se libera
+    int bits = 1;
+    while ((1 << bits) < 2 * count) {
+        bits++;
+    }
+    int mask = (1 << bits) - 1;
+    memset(table, 0, (mask + 1) * sizeof(int));
+
+    int size = 0;
+    for (int i = 0; i < count; i++) {
+        unsigned int h = ((unsigned int)autonomies[i] * 0x9E3779B1u) >> (32 - bits);
+        while (table[h] != 0 && distinct[table[h] - 1].autonomy != autonomies[i]) {
+            h = (h + 1) & mask;
+        }
+        if (table[h] == 0) {
+            distinct[size].autonomy = autonomies[i];
+            distinct[size].count = 0;
+            table[h] = ++size;
+        }
+        distinct[table[h] - 1].count++;
+    }
+
+    // Poche voci distinte: l'ordinamento per inserimento costa meno di qsort
+    if (size > 32) {
+        qsort(distinct, size, sizeof(AutoCount), compare_auto_counts);
+    } else {
+        for (int i = 1; i < size; i++) {
+            AutoCount item = distinct[i];
+            int j = i;
+            while (j > 0 && distinct[j - 1].autonomy > item.autonomy) {
+                distinct[j] = distinct[j - 1];
+                j--;
+            }
+            distinct[j] = item;
+        }
+    }
+
+    fleet_reserve(index, fleet, size);
+    memcpy(fleet_items(fleet), distinct, size * sizeof(AutoCount));
+    fleet->size = size;
+}
+
+int get_max_autonomy_auto(Fleet* fleet) {
+    if (fleet->size == 0) {
+        return -1;  // Indica che il parco auto  vuoto
+    }
+
+    return fleet_items(fleet)[fleet->size - 1].autonomy;
+}
+
+// Riporta nei reach dell'albero l'autonomia massima attuale della stazione: scende
+// fino alla foglia e risale aggiornando solo le voci del percorso, fermandosi alla
+// prima che non cambia. O(log n) nodi visitati.
+void reach_tree_update(StationIndex* index, Station* station) {
+    BTreeNode* path[64];
+    int child[64];
+    int depth = 0;
+
+    BTreeNode* node = index->root;
+    while (!node->is_leaf) {
+        int c = node_upper_bound(node, station->distance);
+        path[depth] = node;
+        child[depth] = c;
+        depth++;
+        node = node->children[c];
+    }
+    int k = node_lower_bound(node, station->distance);
+    int32_t old_autonomy = node->autonomy[k];
+    int32_t autonomy = station_autonomy(station);
+    node->autonomy[k] = autonomy;
+
+    long long distance = station->distance;
+    if (autonomy > old_autonomy) {
+        while (depth > 0 && btree_widen_child(path[depth - 1], child[depth - 1], distance - autonomy, distance + autonomy)) {
+            depth--;
+        }
+    } else if (autonomy < old_autonomy) {
+        while (depth > 0 && btree_shrink_child(path[depth - 1], child[depth - 1], distance - old_autonomy, distance + old_autonomy)) {
+            depth--;
+        }
+    }
+}
+
+// Restituisce false per fermare reach_tree_visit
+typedef bool (*ReachVisitor)(Station* station, void* context);
+
+bool reach_tree_visit_node(BTreeNode* node, int x, int a, int b, ReachVisitor visit, void* context) {
+    if (node->is_leaf) {
+        for (int k = node_lower_bound(node, a); k < node->num_keys && node->keys[k] <= b; k++) {
+            long long from = (long long)node->keys[k] - node->autonomy[k];
+            long long to = (long long)node->keys[k] + node->autonomy[k];
+            if (from <= x && x <= to && !visit(node->stations[k], context)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int last = node_upper_bound(node, b);
+    for (int c = node_upper_bound(node, a); c <= last; c++) {
+        if (node->reach_min[c] <= x && x <= node->reach_max[c] &&
+            !reach_tree_visit_node(node->children[c], x, a, b, visit, context)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Visita in ordine di distanza le stazioni in [a, b] che raggiungono x, cio con
+// distance - autonomia <= x <= distance + autonomia. Un sottoalbero si visita solo
+// se il suo intervallo copre x, e allora contiene almeno una di queste stazioni
+// oppure x o un estremo di [a, b]: k stazioni costano O((k + 1) log n) nodi.
+void reach_tree_visit(StationIndex* index, int x, int a, int b, ReachVisitor visit, void* context) {
+    if (index->root != NULL && a <= b) {
+        reach_tree_visit_node(index->root, x, a, b, visit, context);
+    }
+}
+
+void insert_auto(StationIndex* index, int distance, int autonomy, int* is_added) {
+    Station* station = search_station(index, distance);
+
+    if (station == NULL) {
+        *is_added = 0;  // Imposta il flag per indicare che l'auto NON  stata aggiunta
+        return;
+    }
+
+    // Solo un aumento dell'autonomia massima cambia le stazioni raggiungibili
+    int old_max = get_max_autonomy_auto(&station->fleet);
+    fleet_add(index, &station->fleet, autonomy);
+    if (autonomy > old_max) {
+        record_route_change(index, distance, false);
+        reach_tree_update(index, station);
+    }
+
+    *is_added = 1;  // Imposta il flag per indicare che l'auto  stata aggiunta
+}
+
+void remove_auto(StationIndex* index, int distance, int autonomy, int* is_removed) {
+    // Cerca la stazione con la distanza specificata nell'indice
+    Station* station = search_station(index, distance);
+
+    if (station == NULL) {
+        *is_removed = 0;  // Imposta il flag per indicare che l'auto NON  stata rimossa
+        return;
+    }
+
+    // Cerca l'auto con l'autonomia specificata e la rimuove
+    int old_max = get_max_autonomy_auto(&station->fleet);
+    *is_removed = fleet_remove(index, &station->fleet, autonomy);
+    if (*is_removed && get_max_autonomy_auto(&station->fleet) != old_max) {
+        record_route_change(index, distance, false);
+        reach_tree_update(index, station);
+    }
+}
+
+void add_car(StationIndex* index, int distance, int num_auto, int autonomies[], int* is_station_added) {
+    Station* station = NULL;
+
+    // Inizio codice di insert_station
+    if (index->root == NULL) {
+        index->root = create_btree_node(index, true);
+    }
+
+    int separator;
+    STATS_INC(tree_descents);
+    BTreeNode* new_sibling = btree_insert(index, index->root, distance, &station, &separator);
+
+    // La radice si  divisa: l'albero cresce di un livello
+    if (new_sibling != NULL) {
+        BTreeNode* new_root = create_btree_node(index, false);
+        new_root->keys[0] = separator;
+        new_root->children[0] = index->root;
+        new_root->children[1] = new_sibling;
+        new_root->num_keys = 1;
+        btree_rebuild_reach(new_root);
+        index->root = new_root;
+    }
+
+    if (station == NULL) {
+        // Se l'albero era vuoto la radice creata sopra resta senza chiavi
+        if (index->root->num_keys == 0) {
+            slab_free(&index->node_pool, index->root);
+            index->root = NULL;
+        }
+        *is_station_added = 0;
+        return;
+    }
+
+    *is_station_added = 1;
+    index->size++;
+    record_route_change(index, distance, true);
+
+    // Utilizza il riferimento alla nuova stazione per inserire le auto nel suo parco
+    fleet_build(index, &station->fleet, autonomies, num_auto);
+    reach_tree_update(index, station);
+}
+
+// Porta un array di int ad almeno needed elementi raddoppiando la capacit, che
+// parte da initial. needed  size_t perch i chiamanti sommano conteggi letti
+// dall'input: oltre INT_MAX elementi si termina come per la memoria esaurita. Il
+// risultato non  mai NULL, anche con needed == 0.
+int* reserve_int_array(int* array, int* capacity, size_t needed, int initial) {
+    if (needed <= (size_t)*capacity && array != NULL) {
+        return array;
+    }
+    if (needed > INT_MAX) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+
+    size_t new_capacity = *capacity > 0 ? (size_t)*capacity : (size_t)initial;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    if (new_capacity > INT_MAX) {
+        new_capacity = INT_MAX;
+    }
+
+    array = (int*)realloc(array, new_capacity * sizeof(int));
+    if (array == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    *capacity = (int)new_capacity;
+    return array;
+}
+
+// Buffer per le num_auto autonomie del prossimo comando del batch
+int* station_batch_reserve(StationBatch* batch, int num_auto) {
+    batch->autonomies = reserve_int_array(batch->autonomies, &batch->autonomies_capacity,
+                                          (size_t)batch->autonomies_count + (size_t)num_auto, 1024);
+    return batch->autonomies + batch->autonomies_count;
+}
+
+// Aggiunge al batch il comando le cui autonomie sono state lette in station_batch_reserve
+void station_batch_push(StationBatch* batch, int distance, int num_auto) {
+    if (batch->count == batch->capacity) {
+        batch->capacity = batch->capacity > 0 ? batch->capacity * 2 : 1024;
+        batch->items = (StationBatchItem*)realloc(batch->items, batch->capacity * sizeof(StationBatchItem));
+        batch->added = (bool*)realloc(batch->added, batch->capacity * sizeof(bool));
+        if (batch->items == NULL || batch->added == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    StationBatchItem* item = &batch->items[batch->count];
+    item->distance = distance;
+    item->num_auto = num_auto;
+    item->first_auto = batch->autonomies_count;
+    item->order = batch->count;
+    batch->count++;
+    batch->autonomies_count += num_auto;
+}
+
+void free_station_batch(StationBatch* batch) {
+    free(batch->items);
+    free(batch->added);
+    free(batch->autonomies);
+}
+
+int compare_batch_items(const void* a, const void* b) {
+    const StationBatchItem* x = (const StationBatchItem*)a;
+    const StationBatchItem* y = (const StationBatchItem*)b;
+    if (x->distance != y->distance) {
+        return (x->distance > y->distance) - (x->distance < y->distance);
+    }
+    return x->order - y->order;
+}
+
+void btree_release_nodes(StationIndex* index, BTreeNode* node) {
+    if (!node->is_leaf) {
+        for (int c = 0; c <= node->num_keys; c++) {
+            btree_release_nodes(index, node->children[c]);
+        }
+    }
+    slab_free(&index->node_pool, node);
+}
+
+// Esegue i comandi del batch con gli stessi esiti di add_car chiamata in ordine. Se
+// il batch  grande rispetto alla rete, le stazioni nuove vengono ordinate una volta
+// e fuse con quelle esistenti, e l'albero si ricostruisce con btree_bulk_build
+// invece di scendere per ogni stazione.
+void add_station_batch(StationIndex* index, StationBatch* batch) {
+    if (batch->count < STATION_BATCH_MIN || (long long)batch->count * 16 < index->size) {
+        for (int i = 0; i < batch->count; i++) {
+            StationBatchItem* item = &batch->items[i];
+            int is_added;
+            add_car(index, item->distance, item->num_auto, batch->autonomies + item->first_auto, &is_added);
+            batch->added[i] = is_added;
+        }
+        return;
+    }
+
+    // I caricamenti iniziali arrivano spesso gi in ordine
+    bool sorted = true;
+    for (int i = 1; i < batch->count && sorted; i++) {
+        sorted = batch->items[i - 1].distance < batch->items[i].distance;
+    }
+    if (!sorted) {
+        qsort(batch->items, batch->count, sizeof(StationBatchItem), compare_batch_items);
+    }
+
+    Station** stations = (Station**)malloc((index->size + batch->count) * sizeof(Station*));
+    if (stations == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+
+    int total = 0;
+    StationCursor it = station_first(index);
+    Station* existing = station_cursor_get(&it);
+    for (int i = 0; i < batch->count; i++) {
+        StationBatchItem* item = &batch->items[i];
+        batch->added[item->order] = false;
+
+        // Tra i comandi con la stessa distanza vale il primo, come con add_car
+        if (i > 0 && item->distance == batch->items[i - 1].distance) {
+            continue;
+        }
+        while (existing != NULL && existing->distance < item->distance) {
+            stations[total++] = existing;
+            station_cursor_next(&it);
+            existing = station_cursor_get(&it);
+        }
+        if (existing != NULL && existing->distance == item->distance) {
+            continue;
+        }
+
+        Station* station = create_station(index, item->distance);
+        fleet_build(index, &station->fleet, batch->autonomies + item->first_auto, item->num_auto);
+        stations[total++] = station;
+        record_route_change(index, item->distance, true);
+        batch->added[item->order] = true;
+    }
+    while (existing != NULL) {
+        stations[total++] = existing;
+        station_cursor_next(&it);
+        existing = station_cursor_get(&it);
+    }
+
+    // Le stazioni restano le stesse, cambiano solo i nodi
+    if (index->root != NULL) {
+        btree_release_nodes(index, index->root);
+    }
+    index->root = NULL;
+    index->size = 0;
+    btree_bulk_build(index, stations, total);
+    free(stations);
+}
+
+bool command_is_mutation(CommandType command) {
+    return command == CMD_AGGIUNGI_STAZIONE || command == CMD_DEMOLISCI_STAZIONE ||
+           command == CMD_AGGIUNGI_AUTO || command == CMD_ROTTAMA_AUTO;
+}
+
+void free_mutation_log(MutationLog* log) {
+    free(log->stations);
+    free(log->slots);
+    free(log->cars);
+    free(log->autonomies);
+    free_station_batch(&log->batch);
+}
+
+// Stazione del log con la distanza indicata; alla prima modifica la si cerca
+// nell'indice, una volta sola fino alla prossima applicazione del log
+PendingStation* mutation_log_find(MutationLog* log, StationIndex* index, int distance) {
+    if (2 * (log->count + 1) > log->slots_capacity) {
+        int capacity = log->slots_capacity > 0 ? log->slots_capacity * 2 : MUTATION_LOG_MIN_SLOTS;
+        free(log->slots);
+        log->slots = (int*)malloc(capacity * sizeof(int));
+        if (log->slots == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+        memset(log->slots, 0xff, capacity * sizeof(int));
+        log->slots_capacity = capacity;
+        for (int i = 0; i < log->count; i++) {
+            unsigned int h = (unsigned int)log->stations[i].distance * 2654435761u;
+            while (log->slots[h & (capacity - 1)] != -1) {
+                h++;
+            }
+            log->slots[h & (capacity - 1)] = i;
+            log->stations[i].slot = h & (capacity - 1);
+        }
+    }
+
+    unsigned int h = (unsigned int)distance * 2654435761u;
+    for (;; h++) {
+        int i = log->slots[h & (log->slots_capacity - 1)];
+        if (i == -1) {
+            break;
+        }
+        if (log->stations[i].distance == distance) {
+            return &log->stations[i];
+        }
+    }
+
+    if (log->count == log->capacity) {
+        log->capacity = log->capacity > 0 ? log->capacity * 2 : 1024;
+        log->stations = (PendingStation*)realloc(log->stations, log->capacity * sizeof(PendingStation));
+        if (log->stations == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    PendingStation* station = &log->stations[log->count];
+    station->distance = distance;
+    station->base = search_station(index, distance);
+    station->exists = station->base != NULL;
+    station->replaced = false;
+    station->num_auto = 0;
+    station->cars = -1;
+    station->slot = h & (log->slots_capacity - 1);
+    log->slots[station->slot] = log->count++;
+    return station;
+}
+
+// Variazione del parco auto della stazione per l'autonomia indicata, creata a zero
+PendingCar* mutation_log_car(MutationLog* log, PendingStation* station, int autonomy) {
+    for (int c = station->cars; c != -1; c = log->cars[c].next) {
+        if (log->cars[c].autonomy == autonomy) {
+            return &log->cars[c];
+        }
+    }
+
+    if (log->cars_count == log->cars_capacity) {
+        log->cars_capacity = log->cars_capacity > 0 ? log->cars_capacity * 2 : 1024;
+        log->cars = (PendingCar*)realloc(log->cars, log->cars_capacity * sizeof(PendingCar));
+        if (log->cars == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    PendingCar* car = &log->cars[log->cars_count];
+    car->autonomy = autonomy;
+    car->count = 0;
+    car->next = station->cars;
+    station->cars = log->cars_count++;
+    return car;
+}
+
+// Auto con l'autonomia indicata nella stazione come la vedono i comandi
+int mutation_log_car_count(MutationLog* log, PendingStation* station, PendingCar* car) {
+    int count = car->count;
+    if (!station->replaced) {
+        count += fleet_count(&station->base->fleet, car->autonomy);
+    } else {
+        for (int i = 0; i < station->num_auto; i++) {
+            count += log->autonomies[station->first_auto + i] == car->autonomy;
+        }
+    }
+    return count;
+}
+
+int compare_pending_stations(const void* a, const void* b) {
+    int x = ((const PendingStation*)a)->distance;
+    int y = ((const PendingStation*)b)->distance;
+    return (x > y) - (x < y);
+}
+
+// Porta nell'indice le modifiche del log in un solo passaggio per distanza crescente:
+// prima le demolizioni e le auto delle stazioni esistenti, poi le stazioni nuove,
+// caricate insieme da add_station_batch
+void mutation_log_apply(MutationLog* log, StationIndex* index) {
+    if (log->count == 0) {
+        return;
+    }
+    STATS_INC(log_flushes);
+
+    // Dopo un log grande, come quello del caricamento iniziale, la tabella torna
+    // piccola: con poche voci sparse in una tabella grande ogni ricerca  un cache miss
+    if (log->slots_capacity > 4 * MUTATION_LOG_MIN_SLOTS) {
+        free(log->slots);
+        log->slots = NULL;
+        log->slots_capacity = 0;
+    } else {
+        for (int i = 0; i < log->count; i++) {
+            log->slots[log->stations[i].slot] = -1;
+        }
+    }
+    qsort(log->stations, log->count, sizeof(PendingStation), compare_pending_stations);
+
+    StationBatch* batch = &log->batch;
+    batch->count = 0;
+    batch->autonomies_count = 0;
+    for (int i = 0; i < log->count; i++) {
+        PendingStation* station = &log->stations[i];
+        if (!station->replaced) {
+            if (!station->exists) {
+                continue;
+            }
+            // Le variazioni compensate non cambiano il parco auto
+            Fleet* fleet = &station->base->fleet;
+            int old_max = get_max_autonomy_auto(fleet);
+            bool changed = false;
+            for (int c = station->cars; c != -1; c = log->cars[c].next) {
+                PendingCar* car = &log->cars[c];
+                for (int k = 0; k < car->count; k++) {
+                    fleet_add(index, fleet, car->autonomy);
+                }
+                for (int k = 0; k > car->count; k--) {
+                    fleet_remove(index, fleet, car->autonomy);
+                }
+                changed |= car->count != 0;
+            }
+            if (get_max_autonomy_auto(fleet) != old_max) {
+                record_route_change(index, station->distance, false);
+                reach_tree_update(index, station->base);
+            }
+            if (changed) {
+                STATS_INC(log_stations);
+            }
+            continue;
+        }
+
+        if (station->base != NULL) {
+            int is_removed;
+            delete_station(index, station->distance, &is_removed);
+            STATS_INC(log_stations);
+        }
+        if (station->exists) {
+            // Le auto dell'ultimo aggiungi-stazione con le variazioni successive
+            int num_auto = station->num_auto;
+            for (int c = station->cars; c != -1; c = log->cars[c].next) {
+                if (log->cars[c].count > 0) {
+                    num_auto += log->cars[c].count;
+                }
+            }
+            int* autonomie = station_batch_reserve(batch, num_auto);
+            if (station->num_auto > 0) {
+                memcpy(autonomie, log->autonomies + station->first_auto, station->num_auto * sizeof(int));
+            }
+            num_auto = station->num_auto;
+            for (int c = station->cars; c != -1; c = log->cars[c].next) {
+                PendingCar* car = &log->cars[c];
+                for (int k = 0; k < car->count; k++) {
+                    autonomie[num_auto++] = car->autonomy;
+                }
+                for (int k = 0, removed = 0; removed > car->count; k++) {
+                    if (autonomie[k] == car->autonomy) {
+                        autonomie[k--] = autonomie[--num_auto];
+                        removed--;
+                    }
+                }
+            }
+            station_batch_push(batch, station->distance, num_auto);
+            STATS_INC(log_stations);
+        }
+    }
+    if (batch->count > 0) {
+        add_station_batch(index, batch);
+    }
+
+    log->count = 0;
+    log->cars_count = 0;
+    log->autonomies_count = 0;
+}
+
+// Esegue una modifica sul log e scrive subito la risposta. autonomie sono quelle di
+// aggiungi-stazione.
+void mutation_log_execute(MutationLog* log, OutputBuffer* out, StationIndex* index, ParsedCommand* cmd, const int* autonomie) {
+    PendingStation* station = mutation_log_find(log, index, cmd->args[0]);
+
+    if (cmd->type == CMD_AGGIUNGI_STAZIONE) {
+        if (station->exists) {
+            output_string(out, "non aggiunta\n");
+        } else {
+            int num_auto = cmd->args[1];
+            log->autonomies = reserve_int_array(log->autonomies, &log->autonomies_capacity,
+                                                (size_t)log->autonomies_count + (size_t)num_auto, 1024);
+            if (num_auto > 0) {
+                memcpy(log->autonomies + log->autonomies_count, autonomie, num_auto * sizeof(int));
+            }
+            station->first_auto = log->autonomies_count;
+            station->num_auto = num_auto;
+            log->autonomies_count += num_auto;
+            station->exists = true;
+            station->replaced = true;
+            station->cars = -1;
+            output_string(out, "aggiunta\n");
+        }
+    } else if (cmd->type == CMD_DEMOLISCI_STAZIONE) {
+        if (station->exists) {
+            station->exists = false;
+            station->replaced = true;
+            station->num_auto = 0;
+            station->cars = -1;
+            output_string(out, "demolita\n");
+        } else {
+            output_string(out, "non demolita\n");
+        }
+    } else if (cmd->type == CMD_AGGIUNGI_AUTO) {
+        if (station->exists) {
+            mutation_log_car(log, station, cmd->args[1])->count++;
+            output_string(out, "aggiunta\n");
+        } else {
+            output_string(out, "non aggiunta\n");
+        }
+    } else if (cmd->type == CMD_ROTTAMA_AUTO) {
+        PendingCar* car = station->exists ? mutation_log_car(log, station, cmd->args[1]) : NULL;
+        if (car != NULL && mutation_log_car_count(log, station, car) > 0) {
+            car->count--;
+            output_string(out, "rottamata\n");
+        } else {
+            output_string(out, "non rottamata\n");
+        }
+    }
+
+    // Il log resta limitato anche senza query
+    if (log->count >= MUTATION_LOG_MAX_STATIONS || log->autonomies_count >= STATION_BATCH_MAX_AUTOS ||
+        log->cars_count >= MUTATION_LOG_MAX_STATIONS) {
+        mutation_log_apply(log, index);
+    }
+}
+
+void resize_min_heap(MinHeap* heap) {
+    // Il vecchio array resta nell'arena fino alla fine della query
+    MinHeapNode* array = (MinHeapNode*)arena_alloc(heap->arena, 2 * heap->capacity * sizeof(MinHeapNode));
+    memcpy(array, heap->array, heap->size * sizeof(MinHeapNode));
+    heap->array = array;
+    heap->capacity *= 2;
+}
+
+// Ordinamento della coda: distance_dijkstra e poi sum_distances_from_zero
+bool heap_node_less(const MinHeapNode* a, const MinHeapNode* b) {
+    return a->distance_dijkstra < b->distance_dijkstra ||
+           (a->distance_dijkstra == b->distance_dijkstra && a->sum_distances_from_zero < b->sum_distances_from_zero);
+}
+
+// Scambia due elementi aggiornando la posizione memorizzata nelle stazioni
+void swap_heap_nodes(MinHeap* heap, int i, int j) {
+    MinHeapNode temp = heap->array[i];
+    heap->array[i] = heap->array[j];
+    heap->array[j] = temp;
+    heap->array[i].station->heap_index = i;
+    heap->array[j].station->heap_index = j;
+}
+
+void sift_up_min_heap(MinHeap* heap, int idx) {
+    while (idx) {
+        int parent_idx = (idx - 1) / 2;
+        if (!heap_node_less(&heap->array[idx], &heap->array[parent_idx])) {
+            break;
+        }
+        swap_heap_nodes(heap, idx, parent_idx);
+        idx = parent_idx;
+    }
+}
+
+void insert_in_minHeap(MinHeap* heap, Station* station, long long distance, long long sum_distances_from_zero) {
+    // Controlla se il heap  pieno e, in tal caso, ridimensiona
+    if (heap->size == heap->capacity) {
+        resize_min_heap(heap);
+    }
+
+    MinHeapNode* new_heap_node = &heap->array[heap->size];
+    new_heap_node->station = station;
+    new_heap_node->distance_dijkstra = distance;
+    new_heap_node->sum_distances_from_zero = sum_distances_from_zero;
+    station->heap_index = heap->size;
+    heap->size++;
+    STATS_INC(heap_pushes);
+
+    sift_up_min_heap(heap, heap->size - 1);
+}
+
+void min_heapify(MinHeap* heap, int idx) {
+    int smallest = idx;
+    int left = 2 * idx + 1;
+    int right = 2 * idx + 2;
+
+    if (left < heap->size && heap_node_less(&heap->array[left], &heap->array[smallest])) {
+        smallest = left;
+    }
+
+    if (right < heap->size && heap_node_less(&heap->array[right], &heap->array[smallest])) {
+        smallest = right;
+    }
+
+    if (smallest != idx) {
+        swap_heap_nodes(heap, smallest, idx);
+        min_heapify(heap, smallest);
+    }
+}
+
+// Rimuove e restituisce l'elemento minimo (la coda non deve essere vuota)
+MinHeapNode extract_min(MinHeap* heap) {
+    MinHeapNode root = heap->array[0];
+    root.station->heap_index = -1;
+
+    heap->size--;
+    if (heap->size > 0) {
+        heap->array[0] = heap->array[heap->size];
+        heap->array[0].station->heap_index = 0;
+        min_heapify(heap, 0);
+    }
+
+    return root;
+}
+
+void decrease_key(MinHeap* heap, Station* station, long long distance, long long sum_distances_from_zero) {
+    // La stazione conosce la propria posizione nella coda
+    int i = station->heap_index;
+
+    heap->array[i].distance_dijkstra = distance;
+    heap->array[i].sum_distances_from_zero = sum_distances_from_zero;
+    STATS_INC(heap_decrease_keys);
+
+    sift_up_min_heap(heap, i);
+}
+
+int is_in_heap(Station* station) {
+    return station->heap_index != -1;
+}
+
+// Le stazioni adiacenti sono quelle dentro l'autonomia massima della stazione corrente
+// e dentro l'intervallo [dest, src]: la visita parte dal primo estremo della finestra
+// con una ricerca nell'indice e si ferma al secondo, senza toccare le altre stazioni.
+void traverse_to_update_adjacent(StationIndex* index, Station* station, MinHeap* min_heap, int dest, int src) {
+    int max_autonomy = get_max_autonomy_auto(&station->fleet);
+    Station* node;
+
+    if (max_autonomy == -1) {
+        return;
+    }
+
+    int lower = dest < src ? dest : src;
+    int upper = dest < src ? src : dest;
+    long long from = (long long)station->distance - max_autonomy;
+    long long to = (long long)station->distance + max_autonomy;
+    if (from < lower) {
+        from = lower;
+    }
+    if (to > upper) {
+        to = upper;
+    }
+
+    for (StationCursor it = station_lower_bound(index, (int)from); (node = station_cursor_get(&it)) != NULL && node->distance <= to; station_cursor_next(&it)) {
+        touch_station(node);
+        STATS_INC(relaxations);
+
+        int distance = abs(station->distance - node->distance);
+        long long nuova_distance = station->distance_dijkstra + distance;
+        long long nuova_sum_distances_from_zero = station->sum_distances_from_zero + node->distance;
+
+        if (nuova_distance < node->distance_dijkstra ||
+            (nuova_distance == node->distance_dijkstra && nuova_sum_distances_from_zero < node->sum_distances_from_zero)) {
+            node->distance_dijkstra = nuova_distance;
+            node->sum_distances_from_zero = nuova_sum_distances_from_zero;
+            if(node->distance != station->distance) {
+                node->prev = station;
+            }
+
+            // Se il nodo non  gi nel Min Heap, inseriscilo
+            if (!is_in_heap(node)) {
+                insert_in_minHeap(min_heap, node, nuova_distance, nuova_sum_distances_from_zero);
+            } else {
+                // Altrimenti, aggiorna il nodo nella coda di priorit
+                decrease_key(min_heap, node, nuova_distance, nuova_sum_distances_from_zero);
+            }
+        }
+    }
+}
+
+void update_adjacent_stations(Station* current_station, StationIndex* index, MinHeap* min_heap, int dest, int src) {
+    traverse_to_update_adjacent(index, current_station, min_heap, dest, src);
+}
+
+MinHeap* create_min_heap(Arena* arena, int capacity) {
+    MinHeap* heap = (MinHeap*)arena_alloc(arena, sizeof(MinHeap));
+    heap->array = (MinHeapNode*)arena_alloc(arena, capacity * sizeof(MinHeapNode));
+    heap->size = 0;
+    heap->capacity = capacity;
+    heap->arena = arena;
+
+    return heap;
+}
+
+
+void dijkstra_adattato(StationIndex* index, RouteWorkspace* ws, int dest, int src) {
+    if (index->root == NULL) return;
+
+    // Inizializzazione
+    Station* dest_node = search_station(index, dest);
+    if (dest_node == NULL) return;
+    touch_station(dest_node);
+    dest_node->distance_dijkstra = 0;
+
+    MinHeap* min_heap = create_min_heap(&ws->arena, MIN_HEAP_CAPACITY);  // Inizializza con una capacit arbitraria
+    insert_in_minHeap(min_heap, dest_node, 0, 0);
+
+    while (min_heap->size != 0) {
+        Station* current_station = extract_min(min_heap).station;
+        STATS_INC(nodes_expanded);
+
+        // Se il nodo corrente  il nodo di arrivo, interrompi l'algoritmo.
+        if (current_station->distance == src) {
+            break;
+        }
+
+        // Per ogni stazione adiacente...
+        update_adjacent_stations(current_station, index, min_heap, dest, src);
+    }
+
+    // Le posizioni rimaste nelle stazioni scadono con l'epoca della query
+    // e la memoria della coda si libera azzerando l'arena
+    arena_reset(&ws->arena);
+}
+
+void reserve_route_workspace(RouteWorkspace* ws, int capacity) {
+    if (capacity <= ws->capacity) {
+        return;
+    }
+
+    int new_capacity = ws->capacity > 0 ? ws->capacity : MIN_HEAP_CAPACITY;
+    while (new_capacity < capacity) {
+        new_capacity *= 2;
+    }
+
+    ws->window = realloc(ws->window, new_capacity * sizeof(Station*));
+    ws->prev = realloc(ws->prev, new_capacity * sizeof(int));
+    ws->autonomy = realloc(ws->autonomy, new_capacity * sizeof(int32_t));
+    ws->path = realloc(ws->path, new_capacity * sizeof(int));
+    if (ws->window == NULL || ws->prev == NULL || ws->autonomy == NULL || ws->path == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    ws->capacity = new_capacity;
+}
+
+void free_route_workspace(RouteWorkspace* ws) {
+    free(ws->window);
+    free(ws->prev);
+    free(ws->autonomy);
+    free(ws->path);
+    ws->window = NULL;
+    ws->prev = NULL;
+    ws->autonomy = NULL;
+    ws->path = NULL;
+    ws->capacity = 0;
+    free_arena(&ws->arena);
+    free(ws->verify_path);
+    ws->verify_path = NULL;
+    ws->verify_capacity = 0;
+    free(ws->view_distance);
+    free(ws->view_reach);
+    ws->view_distance = NULL;
+    ws->view_reach = NULL;
+    ws->view_capacity = 0;
+}
+
+// Pianificatore lineare. Le stazioni stanno su una retta e ogni stazione raggiunge un
+// intervallo, quindi tutti i percorsi senza inversioni da dest a src hanno lo stesso
+// costo di dijkstra_adattato e vince quello con sum_distances_from_zero minima: il
+// predecessore ottimo di ogni stazione  la prima stazione della finestra che la
+// raggiunge. Scorrendo la finestra in ordine questo indice non torna mai indietro,
+// per cui la query costa O(k) sulle k stazioni tra dest e src.
+// Restituisce 1 e scrive le tappe in ws->path se esiste un percorso.
+int sweep_percorso(StationIndex* index, RouteWorkspace* ws, int dest, int src) {
+    int count = 0;
+    Station* station;
+
+    ws->path_length = 0;
+
+    for (StationCursor it = station_lower_bound(index, dest); (station = station_cursor_get(&it)) != NULL && station->distance <= src; station_cursor_next(&it)) {
+        if (count == ws->capacity) {
+            reserve_route_workspace(ws, count + 1);
+        }
+        ws->autonomy[count] = it.leaf->autonomy[it.pos];
+        ws->window[count++] = station;
+    }
+
+    STATS_ADD(sweep_stations, count);
+
+    if (count == 0 || ws->window[0]->distance != dest || ws->window[count - 1]->distance != src) {
+        return 0;
+    }
+
+    // p  il primo candidato predecessore: le stazioni prima di p non raggiungono
+    // la stazione corrente e quindi nessuna delle successive
+    int p = 0;
+    ws->prev[0] = -1;
+    for (int j = 1; j < count; j++) {
+        int target = ws->window[j]->distance;
+        while (p < j && target - ws->window[p]->distance > ws->autonomy[p]) {
+            p++;
+        }
+        if (p == j) {
+            // Le stazioni raggiungibili sono un prefisso della finestra
+            return 0;
+        }
+        ws->prev[j] = p;
+    }
+
+    int length = 0;
+    for (int j = count - 1; j != -1; j = ws->prev[j]) {
+        length++;
+    }
+    ws->path_length = length;
+    for (int j = count - 1; j != -1; j = ws->prev[j]) {
+        ws->path[--length] = ws->window[j]->distance;
+    }
+
+    return 1;
+}
+
+bool reach_first_visitor(Station* station, void* context) {
+    *(Station**)context = station;
+    return false;
+}
+
+// Pianificatore sull'albero aumentato: risale da src prendendo come tappa precedente
+// la prima stazione che la raggiunge, come sweep_percorso. Le tappe minime da dest
+// non diminuiscono con la distanza, quindi se quella stazione non  raggiungibile
+// da dest non lo  nessuna. Ogni tappa  una visita dell'albero fermata al primo
+// risultato: la query costa O(h log n) per h tappe, non O(k) sulle k stazioni
+// tra dest e src.
+int reach_tree_percorso(StationIndex* index, RouteWorkspace* ws, int dest, int src) {
+    ws->path_length = 0;
+    if (search_station(index, dest) == NULL || search_station(index, src) == NULL) {
+        return 0;
+    }
+
+    reserve_route_workspace(ws, 2);
+    int length = 0;
+    int x = src;
+    ws->path[length++] = x;
+    while (x != dest) {
+        Station* first = NULL;
+        reach_tree_visit(index, x, dest, x - 1, reach_first_visitor, &first);
+        if (first == NULL) {
+            return 0;
+        }
+        x = first->distance;
+        reserve_route_workspace(ws, length + 1);
+        ws->path[length++] = x;
+    }
+
+    for (int i = 0, j = length - 1; i < j; i++, j--) {
+        int temp = ws->path[i];
+        ws->path[i] = ws->path[j];
+        ws->path[j] = temp;
+    }
+    ws->path_length = length;
+    return 1;
+}
+
+// Indice a salti: refresh e query. L'indice viene aggiornato solo quando arriva un
+// pianifica-percorso, e le modifiche registrate nel log delle versioni dicono fin
+// dove: i campi di una stazione dipendono solo dalle stazioni che la seguono,
+// quindi basta ricalcolare il prefisso fino alla modifica pi lontana.
+
+// Stazione con reach massimo tra [i, i + 2^k) e [j, j + 2^k)
+int jump_best_of(JumpIndex* jx, int i, int j, int k) {
+    int a = i + jx->range_max[k][i];
+    int b = j + jx->range_max[k][j];
+    return jx->reach[b] > jx->reach[a] ? b : a;
+}
+
+// Prima stazione dopo from con distance > limit
+int jump_upper_bound(JumpIndex* jx, int from, long long limit) {
+    int lo = from, hi = jx->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (jx->distance[mid] <= limit) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void jump_index_grow(JumpIndex* jx, int count) {
+    int capacity = jx->capacity > 0 ? jx->capacity : 64;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    int levels = 1;
+    while ((1 << (levels - 1)) < capacity) {
+        levels++;
+    }
+
+    jx->distance = (int*)realloc(jx->distance, capacity * sizeof(int));
+    jx->reach = (long long*)realloc(jx->reach, capacity * sizeof(long long));
+    if (jx->distance == NULL || jx->reach == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    for (int k = 0; k < levels; k++) {
+        jx->jump[k] = (int*)realloc(jx->jump[k], capacity * sizeof(int));
+        jx->range_max[k] = (int*)realloc(jx->range_max[k], capacity * sizeof(int));
+        if (jx->jump[k] == NULL || jx->range_max[k] == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    jx->capacity = capacity;
+    jx->levels = levels;
+}
+
+// Ricalcola i campi delle stazioni [0, prefix) da destra a sinistra: quelli delle
+// stazioni successive sono gi aggiornati
+void jump_index_build(JumpIndex* jx, int prefix) {
+    for (int i = prefix - 1; i >= 0; i--) {
+        int last = jump_upper_bound(jx, i, jx->reach[i]) - 1;
+        int best = i;
+        if (last > i) {
+            int k = 31 - __builtin_clz((unsigned int)(last - i));
+            best = jump_best_of(jx, i + 1, last - (1 << k) + 1, k);
+        }
+
+        jx->jump[0][i] = best - i;
+        jx->range_max[0][i] = 0;
+        for (int k = 1; k < jx->levels; k++) {
+            int j = i + jx->jump[k - 1][i];
+            jx->jump[k][i] = j + jx->jump[k - 1][j] - i;
+
+            int half = i + (1 << (k - 1));
+            if (half < jx->count) {
+                jx->range_max[k][i] = jump_best_of(jx, i, half, k - 1) - i;
+            } else {
+                jx->range_max[k][i] = jx->range_max[k - 1][i];
+            }
+        }
+    }
+}
+
+void jump_index_refresh(StationIndex* index) {
+    JumpIndex* jx = &index->jump;
+    if (jx->built && jx->version == index->route_version) {
+        return;
+    }
+
+    bool full = !jx->built || index->route_version - jx->version > ROUTE_CHANGE_LOG_SIZE || index->size > jx->capacity;
+    long long limit = LLONG_MAX;
+    int old_prefix = jx->count;
+    if (!full) {
+        limit = INT_MIN;
+        for (unsigned long long v = jx->version + 1; v <= index->route_version; v++) {
+            int distance = index->route_changes[v % ROUTE_CHANGE_LOG_SIZE].distance;
+            if (distance > limit) {
+                limit = distance;
+            }
+        }
+        old_prefix = jump_upper_bound(jx, 0, limit);
+    } else if (index->size > jx->capacity) {
+        jump_index_grow(jx, index->size);
+    }
+
+    int prefix = 0;
+    Station* station;
+    for (StationCursor it = station_first(index); (station = station_cursor_get(&it)) != NULL && station->distance <= limit; station_cursor_next(&it)) {
+        prefix++;
+    }
+
+    // Le stazioni oltre la modifica pi lontana scorrono soltanto
+    int suffix = jx->count - old_prefix;
+    if (!full && suffix > 0 && prefix != old_prefix) {
+        memmove(jx->distance + prefix, jx->distance + old_prefix, suffix * sizeof(int));
+        memmove(jx->reach + prefix, jx->reach + old_prefix, suffix * sizeof(long long));
+        for (int k = 0; k < jx->levels; k++) {
+            memmove(jx->jump[k] + prefix, jx->jump[k] + old_prefix, suffix * sizeof(int));
+            memmove(jx->range_max[k] + prefix, jx->range_max[k] + old_prefix, suffix * sizeof(int));
+        }
+    }
+    jx->count = index->size;
+
+    int i = 0;
+    for (StationCursor it = station_first(index); i < prefix; station_cursor_next(&it), i++) {
+        station = station_cursor_get(&it);
+        jx->distance[i] = station->distance;
+        // Una stazione senza auto raggiunge solo se stessa
+        int autonomy = get_max_autonomy_auto(&station->fleet);
+        jx->reach[i] = (long long)station->distance + (autonomy > 0 ? autonomy : 0);
+    }
+    jump_index_build(jx, prefix);
+
+    jx->built = true;
+    jx->version = index->route_version;
+}
+
+// Prima stazione da from in poi che raggiunge target
+int jump_first_reaching(JumpIndex* jx, int from, long long target) {
+    int i = from;
+    for (int k = jx->levels - 1; k >= 0; k--) {
+        if (i + (1 << k) <= jx->count && jx->reach[i + jx->range_max[k][i]] < target) {
+            i += 1 << k;
+        }
+    }
+    return i;
+}
+
+// Pianificatore sull'indice a salti: il numero minimo di tappe si trova in
+// O(log n) seguendo i salti della ricerca golosa, poi il percorso si ricostruisce
+// all'indietro scegliendo come predecessore la prima stazione che raggiunge la
+// tappa, come fa sweep_percorso. L'indice deve essere gi aggiornato.
+int jump_percorso(StationIndex* index, RouteWorkspace* ws, int dest, int src) {
+    JumpIndex* jx = &index->jump;
+    ws->path_length = 0;
+
+    int lo = jump_upper_bound(jx, 0, dest) - 1;
+    int hi = jump_upper_bound(jx, 0, src) - 1;
+    if (lo < 0 || hi < 0 || jx->distance[lo] != dest || jx->distance[hi] != src) {
+        return 0;
+    }
+
+    long long target = src;
+    int hops = 0;
+    if (lo < hi) {
+        if (jx->reach[lo] >= target) {
+            hops = 1;
+        } else {
+            // Salti pi lunghi possibile senza raggiungere src, poi un'ultima tappa
+            // verso la stazione migliore e una fino a src
+            int a = lo;
+            for (int k = jx->levels - 1; k >= 0; k--) {
+                int b = a + jx->jump[k][a];
+                if (jx->reach[b] < target) {
+                    a = b;
+                    hops += 1 << k;
+                }
+            }
+            if (jx->reach[a + jx->jump[0][a]] < target) {
+                return 0;
+            }
+            hops += 2;
+        }
+    }
+
+    reserve_route_workspace(ws, hops + 1);
+    ws->path_length = hops + 1;
+    STATS_ADD(jump_hops, hops);
+    int j = hi;
+    ws->path[hops] = jx->distance[hi];
+    for (int step = hops - 1; step >= 0; step--) {
+        j = jump_first_reaching(jx, lo, jx->distance[j]);
+        ws->path[step] = jx->distance[j];
+    }
+
+    return 1;
+}
+
+// Vista struct-of-arrays. Viene aggiornata solo quando arriva un pianifica-percorso:
+// le modifiche registrate nel log delle versioni si applicano sul posto, con una
+// ricerca binaria per le autonomie e un memmove per le stazioni aggiunte o
+// demolite; se sono troppe, o il log non le contiene pi, si ricostruisce tutto.
+
+// Kernel sulla vista: prima posizione in [begin, end) con valore >= target (end se
+// non c') e massimo di un intervallo non vuoto
+typedef int (*FirstAtLeastKernel)(const int32_t* values, int begin, int end, int32_t target);
+typedef int32_t (*RangeMaxKernel)(const int32_t* values, int begin, int end);
+
+int first_at_least_scalar(const int32_t* values, int begin, int end, int32_t target) {
+    while (begin < end && values[begin] < target) {
+        begin++;
+    }
+    return begin;
+}
+
+int32_t range_max_scalar(const int32_t* values, int begin, int end) {
+    int32_t best = INT32_MIN;
+    for (int i = begin; i < end; i++) {
+        if (values[i] > best) {
+            best = values[i];
+        }
+    }
+    return best;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.1")))
+int first_at_least_sse(const int32_t* values, int begin, int end, int32_t target) {
+    if (target == INT32_MIN) {
+        return begin;
+    }
+    __m128i bound = _mm_set1_epi32(target - 1);
+    for (; begin + 4 <= end; begin += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + begin));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, bound)));
+        if (mask != 0) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    return first_at_least_scalar(values, begin, end, target);
+}
+
+__attribute__((target("sse4.1")))
+int32_t range_max_sse(const int32_t* values, int begin, int end) {
+    __m128i best = _mm_set1_epi32(INT32_MIN);
+    for (; begin + 4 <= end; begin += 4) {
+        best = _mm_max_epi32(best, _mm_loadu_si128((const __m128i*)(values + begin)));
+    }
+    best = _mm_max_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(1, 0, 3, 2)));
+    best = _mm_max_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t tail = range_max_scalar(values, begin, end);
+    int32_t result = _mm_cvtsi128_si32(best);
+    return tail > result ? tail : result;
+}
+
+// Due vettori per iterazione: le finestre dei livelli sono spesso di decine di stazioni
+__attribute__((target("avx2")))
+int first_at_least_avx2(const int32_t* values, int begin, int end, int32_t target) {
+    if (target == INT32_MIN) {
+        return begin;
+    }
+    __m256i bound = _mm256_set1_epi32(target - 1);
+    for (; begin + 16 <= end; begin += 16) {
+        __m256i a = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(values + begin)), bound);
+        __m256i b = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(values + begin + 8)), bound);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(a)) | (_mm256_movemask_ps(_mm256_castsi256_ps(b)) << 8);
+        if (mask != 0) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    for (; begin + 8 <= end; begin += 8) {
+        __m256i a = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(values + begin)), bound);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(a));
+        if (mask != 0) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    return first_at_least_scalar(values, begin, end, target);
+}
+
+__attribute__((target("avx2")))
+int32_t range_max_avx2(const int32_t* values, int begin, int end) {
+    __m256i a = _mm256_set1_epi32(INT32_MIN);
+    __m256i b = a;
+    for (; begin + 16 <= end; begin += 16) {
+        a = _mm256_max_epi32(a, _mm256_loadu_si256((const __m256i*)(values + begin)));
+        b = _mm256_max_epi32(b, _mm256_loadu_si256((const __m256i*)(values + begin + 8)));
+    }
+    a = _mm256_max_epi32(a, b);
+    __m128i best = _mm_max_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+    best = _mm_max_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(1, 0, 3, 2)));
+    best = _mm_max_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t tail = range_max_scalar(values, begin, end);
+    int32_t result = _mm_cvtsi128_si32(best);
+    return tail > result ? tail : result;
+}
+#endif
+
+FirstAtLeastKernel simd_first_at_least = first_at_least_scalar;
+RangeMaxKernel simd_range_max = range_max_scalar;
+
+// Sceglie i kernel migliori supportati dalla CPU; --simd scalar|sse|avx2 ne limita
+// il livello, per confrontarli
+void select_simd_kernels(const char* level) {
+    simd_first_at_least = first_at_least_scalar;
+    simd_range_max = range_max_scalar;
+    if (level != NULL && strcmp(level, "scalar") == 0) {
+        return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if ((level == NULL || strcmp(level, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        simd_first_at_least = first_at_least_avx2;
+        simd_range_max = range_max_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        simd_first_at_least = first_at_least_sse;
+        simd_range_max = range_max_sse;
+    }
+#endif
+}
+
+int32_t station_max_reach(Station* station) {
+    // Una stazione senza auto raggiunge solo se stessa
+    int autonomy = get_max_autonomy_auto(&station->fleet);
+    long long reach = (long long)station->distance + (autonomy > 0 ? autonomy : 0);
+    return reach > INT32_MAX ? INT32_MAX : (int32_t)reach;
+}
+
+void station_array_reserve(StationArray* array, int count) {
+    if (count <= array->capacity) {
+        return;
+    }
+    int capacity = array->capacity > 0 ? array->capacity : 64;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    array->distance = (int32_t*)realloc(array->distance, capacity * sizeof(int32_t));
+    array->max_reach = (int32_t*)realloc(array->max_reach, capacity * sizeof(int32_t));
+    if (array->distance == NULL || array->max_reach == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    array->capacity = capacity;
+}
+
+// Prima posizione della vista con distance >= distance
+int station_array_lower_bound(StationArray* array, int distance) {
+    int lo = 0, hi = array->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (array->distance[mid] < distance) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void station_array_rebuild(StationIndex* index) {
+    StationArray* array = &index->array;
+    station_array_reserve(array, index->size);
+
+    int i = 0;
+    Station* station;
+    for (StationCursor it = station_first(index); (station = station_cursor_get(&it)) != NULL; station_cursor_next(&it)) {
+        array->distance[i] = station->distance;
+        array->max_reach[i] = station_max_reach(station);
+        i++;
+    }
+    array->count = i;
+}
+
+void station_array_refresh(StationIndex* index) {
+    StationArray* array = &index->array;
+    if (array->built && array->version == index->route_version) {
+        return;
+    }
+
+    bool full = !array->built || index->route_version - array->version > ROUTE_CHANGE_LOG_SIZE;
+    if (!full) {
+        int shifts = 0;
+        for (unsigned long long v = array->version + 1; v <= index->route_version; v++) {
+            shifts += index->route_changes[v % ROUTE_CHANGE_LOG_SIZE].endpoint;
+        }
+        full = shifts > STATION_ARRAY_MAX_SHIFTS;
+    }
+
+    if (full) {
+        station_array_rebuild(index);
+    } else {
+        // Ogni modifica riporta la sua stazione allo stato attuale della rete, quindi
+        // pi modifiche sulla stessa stazione si possono applicare in qualsiasi ordine
+        for (unsigned long long v = array->version + 1; v <= index->route_version; v++) {
+            int distance = index->route_changes[v % ROUTE_CHANGE_LOG_SIZE].distance;
+            int pos = station_array_lower_bound(array, distance);
+            bool present = pos < array->count && array->distance[pos] == distance;
+            Station* station = search_station(index, distance);
+
+            if (station == NULL) {
+                if (present) {
+                    memmove(array->distance + pos, array->distance + pos + 1, (array->count - pos - 1) * sizeof(int32_t));
+                    memmove(array->max_reach + pos, array->max_reach + pos + 1, (array->count - pos - 1) * sizeof(int32_t));
+                    array->count--;
+                }
+                continue;
+            }
+            if (!present) {
+                station_array_reserve(array, array->count + 1);
+                memmove(array->distance + pos + 1, array->distance + pos, (array->count - pos) * sizeof(int32_t));
+                memmove(array->max_reach + pos + 1, array->max_reach + pos, (array->count - pos) * sizeof(int32_t));
+                array->distance[pos] = distance;
+                array->count++;
+            }
+            array->max_reach[pos] = station_max_reach(station);
+        }
+    }
+
+    array->built = true;
+    array->version = index->route_version;
+}
+
+// Pianificatore sulla vista struct-of-arrays, per livelli: il livello t contiene le
+// stazioni raggiungibili con t tappe e non meno, cio quelle dopo il livello t - 1
+// fino al reach massimo visto finora. Per ogni livello un kernel trova la fine della
+// finestra e un altro il reach massimo. Il percorso si ricostruisce all'indietro
+// scegliendo in ogni livello la prima stazione che raggiunge la tappa successiva,
+// come fa sweep_percorso. La vista deve essere gi aggiornata.
+int soa_percorso(StationArray* array, RouteWorkspace* ws, int dest, int src) {
+    ws->path_length = 0;
+
+    int lo = station_array_lower_bound(array, dest);
+    int hi = station_array_lower_bound(array, src);
+    if (hi >= array->count || array->distance[lo] != dest || array->distance[hi] != src) {
+        return 0;
+    }
+
+    // ws->prev contiene gli inizi dei livelli: il livello t  [prev[t], prev[t + 1])
+    reserve_route_workspace(ws, 2);
+    ws->prev[0] = lo;
+    ws->prev[1] = lo + 1;
+    int levels = 1;
+    int32_t reach = array->max_reach[lo];
+    while (reach < src) {
+        int begin = ws->prev[levels];
+        int end = simd_first_at_least(array->distance, begin, hi + 1, reach + 1);
+        if (end == begin) {
+            return 0;
+        }
+        STATS_ADD(sweep_stations, end - begin);
+        int32_t best = simd_range_max(array->max_reach, begin, end);
+        if (best > reach) {
+            reach = best;
+        }
+        reserve_route_workspace(ws, levels + 2);
+        ws->prev[++levels] = end;
+    }
+
+    int hops = lo < hi ? levels : 0;
+    reserve_route_workspace(ws, hops + 1);
+    ws->path_length = hops + 1;
+    int j = hi;
+    ws->path[hops] = src;
+    for (int t = hops - 1; t >= 0; t--) {
+        j = simd_first_at_least(array->max_reach, ws->prev[t], ws->prev[t + 1], array->distance[j]);
+        ws->path[t] = array->distance[j];
+    }
+
+    return 1;
+}
+
+// Pianificatore bidirezionale sulla vista struct-of-arrays. La ricerca in avanti
+// parte da dest per livelli, come soa_percorso; quella all'indietro parte da src e
+// calcola, da destra a sinistra, le tappe minime da ogni stazione fino a src. Per
+// questa basta una pila monotona: le stazioni raggiunte da una stazione sono un
+// prefisso di quelle gi visitate, quindi una stazione con meno tappe rende inutili
+// quelle alla sua destra con tappe uguali o maggiori. Avanza ogni volta la ricerca
+// che ha visitato meno stazioni, finch le due zone si toccano o quella in avanti
+// raggiunge src.
+// La tappa che precede x nel percorso di sweep_percorso  la prima stazione che
+// raggiunge x: nella zona all'indietro  la prima con una tappa in meno di x, in
+// quella in avanti la prima del livello precedente che raggiunge x.
+int bidirectional_percorso(StationArray* array, RouteWorkspace* ws, int dest, int src) {
+    ws->path_length = 0;
+
+    int lo = station_array_lower_bound(array, dest);
+    int hi = station_array_lower_bound(array, src);
+    if (hi >= array->count || array->distance[lo] != dest || array->distance[hi] != src) {
+        return 0;
+    }
+    int n = hi - lo + 1;
+    reserve_route_workspace(ws, n > 2 ? n : 2);
+    if (lo == hi) {
+        ws->path[0] = src;
+        ws->path_length = 1;
+        return 1;
+    }
+
+    // La memoria della query precedente si libera qui. Gli array della ricerca
+    // all'indietro sono indicizzati a partire da lo
+    arena_reset(&ws->arena);
+    int* back_hops = (int*)arena_alloc(&ws->arena, n * sizeof(int));   // -1: src non raggiungibile
+    int* first_back = (int*)arena_alloc(&ws->arena, n * sizeof(int));  // Prima stazione con t tappe
+    int* stack = (int*)arena_alloc(&ws->arena, n * sizeof(int));       // Dal fondo: da destra a sinistra
+    memset(first_back, 0xff, n * sizeof(int));
+
+    // Zona in avanti [lo, e) con i livelli in ws->prev; zona all'indietro [q, hi]
+    ws->prev[0] = lo;
+    ws->prev[1] = lo + 1;
+    int levels = 1;
+    int e = lo + 1;
+    int32_t reach = array->max_reach[lo];
+    int q = hi;
+    back_hops[n - 1] = 0;
+    first_back[0] = hi;
+    stack[0] = hi;
+    int top = 1;
+
+    while (e < q && reach < src) {
+        if (e - lo <= hi - q) {
+            int end = simd_first_at_least(array->distance, e, q, reach + 1);
+            if (end == e) {
+                return 0;
+            }
+            STATS_ADD(sweep_stations, end - e);
+            int32_t best = simd_range_max(array->max_reach, e, end);
+            if (best > reach) {
+                reach = best;
+            }
+            ws->prev[++levels] = end;
+            e = end;
+        } else {
+            int i = --q;
+            STATS_INC(sweep_stations);
+            // Voce pi profonda della pila entro il reach di i
+            int a = 0, b = top;
+            while (a < b) {
+                int mid = a + (b - a) / 2;
+                if (array->distance[stack[mid]] <= array->max_reach[i]) {
+                    b = mid;
+                } else {
+                    a = mid + 1;
+                }
+            }
+            if (a == top) {
+                back_hops[i - lo] = -1;
+                continue;
+            }
+            int hops = back_hops[stack[a] - lo] + 1;
+            back_hops[i - lo] = hops;
+            first_back[hops] = i;
+            while (top > 0 && back_hops[stack[top - 1] - lo] >= hops) {
+                top--;
+            }
+            stack[top++] = i;
+        }
+    }
+
+    // Tappe da src all'indietro, poi si girano: prima nella zona all'indietro finch
+    // nessuna stazione della zona in avanti raggiunge la tappa
+    int length = 0;
+    int x = hi;
+    ws->path[length++] = src;
+    while (reach < array->distance[x]) {
+        int p = first_back[length];
+        if (p == -1 || p >= x) {
+            return 0;
+        }
+        x = p;
+        ws->path[length++] = array->distance[x];
+    }
+
+    x = simd_first_at_least(array->max_reach, lo, e, array->distance[x]);
+    int level = 0, upper = levels;
+    while (level + 1 < upper) {
+        int mid = level + (upper - level) / 2;
+        if (ws->prev[mid] <= x) {
+            level = mid;
+        } else {
+            upper = mid;
+        }
+    }
+    ws->path[length++] = array->distance[x];
+    for (int t = level - 1; t >= 0; t--) {
+        x = simd_first_at_least(array->max_reach, ws->prev[t], ws->prev[t + 1], array->distance[x]);
+        ws->path[length++] = array->distance[x];
+    }
+
+    for (int i = 0, j = length - 1; i < j; i++, j--) {
+        int temp = ws->path[i];
+        ws->path[i] = ws->path[j];
+        ws->path[j] = temp;
+    }
+    ws->path_length = length;
+    return 1;
+}
+
+// Ricostruisce in ws->path le tappe trovate da dijkstra_adattato risalendo i prev
+// da src, senza ricorsione
+void dijkstra_tappe(RouteWorkspace* ws, Station* src_node) {
+    int length = 0;
+    for (Station* node = src_node; node != NULL; node = node->prev) {
+        length++;
+    }
+
+    reserve_route_workspace(ws, length);
+    ws->path_length = length;
+    for (Station* node = src_node; node != NULL; node = node->prev) {
+        ws->path[--length] = node->distance;
+    }
+}
+
+// Stampa le tappe di ws->path: in avanti da dest a src oppure all'indietro
+void stampa_tappe(OutputBuffer* out, RouteWorkspace* ws, bool isForward) {
+    for (int i = 0; i < ws->path_length; i++) {
+        if (i > 0) {
+            output_char(out, ' ');
+        }
+        output_int(out, ws->path[isForward ? i : ws->path_length - 1 - i]);
+    }
+    output_char(out, '\n');
+}
+
+// La ricerca va sempre dalla stazione pi vicina all'inizio dell'autostrada: scambia
+// gli estremi se serve e dice se le tappe vanno stampate al contrario
+bool ordina_estremi(OutputBuffer* out, int* dest, int* src) {
+    bool isForward = false ;
+    if(*src == *dest)
+    {
+        output_int(out, *src);
+        output_string(out, " \n");
+	}
+	if(*dest>*src)
+	{
+	    int temp = *dest ;
+	    *dest = *src ;
+	    *src = temp ;
+	    isForward = true ;
+	}
+    return isForward;
+}
+
+// dijkstra_adattato come motore: le tappe si ricostruiscono da src
+int dijkstra_percorso(StationIndex* index, RouteWorkspace* ws, int dest, int src) {
+    ws->path_length = 0;
+    begin_dijkstra_query(index);
+    dijkstra_adattato(index, ws, dest, src);
+    // Ottieni il nodo di destinazione
+    Station* src_node = search_station(index, src);
+    if (src_node) {
+        touch_station(src_node);
+    }
+    if (!src_node || src_node->distance_dijkstra == LLONG_MAX) {
+        return 0;
+    }
+    dijkstra_tappe(ws, src_node);
+    return 1;
+}
+
+int soa_index_percorso(StationIndex* index, RouteWorkspace* ws, int dest, int src) {
+    return soa_percorso(&index->array, ws, dest, src);
+}
+
+int bidirectional_index_percorso(StationIndex* index, RouteWorkspace* ws, int dest, int src) {
+    return bidirectional_percorso(&index->array, ws, dest, src);
+}
+
+PlannerEngine planner_engines[] = {
+    { "sweep",         false, false, false, true,  sweep_percorso,               NULL },
+    { "soa",           true,  false, false, true,  soa_index_percorso,           soa_percorso },
+    { "bidirectional", true,  false, false, true,  bidirectional_index_percorso, bidirectional_percorso },
+    { "jump",          false, true,  false, false, jump_percorso,                NULL },
+    { "reach",         false, false, false, false, reach_tree_percorso,          NULL },
+    { "dijkstra",      false, false, true,  false, dijkstra_percorso,            NULL },
+};
+
+PlannerEngine* find_planner_engine(const char* name) {
+    for (size_t i = 0; i < sizeof(planner_engines) / sizeof(planner_engines[0]); i++) {
+        if (strcmp(planner_engines[i].name, name) == 0) {
+            return &planner_engines[i];
+        }
+    }
+    return NULL;
+}
+
+// Le query di un batch possono andare ai worker solo se nessun motore scrive
+// nelle stazioni
+bool planner_engines_parallel(void) {
+    return !planner_engine->writes_stations && (verify_engine == NULL || !verify_engine->writes_stations);
+}
+
+unsigned long planner_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+void stampa_tappe_errore(const char* name, int found, int* path, int length) {
+    fprintf(stderr, "  %s:", name);
+    if (!found) {
+        fprintf(stderr, " nessun percorso");
+    }
+    for (int i = 0; i < length; i++) {
+        fprintf(stderr, " %d", path[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+// Esegue entrambi i motori e termina il programma al primo percorso diverso. Il
+// percorso che resta in ws->path  quello del motore principale.
+int verifica_percorso(StationIndex* index, RouteWorkspace* ws, int dest, int src) {
+    unsigned long start = planner_now_ns();
+    int found = planner_engine->plan(index, ws, dest, src);
+    unsigned long middle = planner_now_ns();
+    if (found) {
+        if (ws->path_length > ws->verify_capacity) {
+            ws->verify_capacity = ws->path_length;
+            ws->verify_path = (int*)realloc(ws->verify_path, ws->verify_capacity * sizeof(int));
+            if (ws->verify_path == NULL) {
+                printf("Memory allocation failed\n");
+                exit(1);
+            }
+        }
+        memcpy(ws->verify_path, ws->path, ws->path_length * sizeof(int));
+    }
+    int length = found ? ws->path_length : 0;
+
+    int check = verify_engine->plan(index, ws, dest, src);
+    unsigned long end = planner_now_ns();
+    atomic_fetch_add_explicit(&verify_timing.queries, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&verify_timing.ns[0], middle - start, memory_order_relaxed);
+    atomic_fetch_add_explicit(&verify_timing.ns[1], end - middle, memory_order_relaxed);
+
+    bool same = (found != 0) == (check != 0);
+    if (same && found) {
+        same = ws->path_length == length && memcmp(ws->path, ws->verify_path, length * sizeof(int)) == 0;
+    }
+    if (!same) {
+        fprintf(stderr, "Motori in disaccordo sul percorso tra %d e %d:\n", dest, src);
+        stampa_tappe_errore(planner_engine->name, found, ws->verify_path, length);
+        stampa_tappe_errore(verify_engine->name, check, ws->path, check ? ws->path_length : 0);
+        exit(1);
+    }
+
+    // Con entrambi i percorsi uguali basta rimettere la lunghezza
+    ws->path_length = length;
+    return found;
+}
+
+void stampa_tempi_verifica(void) {
+    unsigned long queries = atomic_load(&verify_timing.queries);
+    double first = atomic_load(&verify_timing.ns[0]) * 1e-9;
+    double second = atomic_load(&verify_timing.ns[1]) * 1e-9;
+    fprintf(stderr, "Verifica: %lu percorsi uguali; %s %.3f s, %s %.3f s\n",
+            queries, planner_engine->name, first, verify_engine->name, second);
+}
+
+void pianifica_percorso(OutputBuffer* out, StationIndex* index, RouteWorkspace* ws, int dest, int src) {
+    bool isForward = ordina_estremi(out, &dest, &src);
+
+    int found;
+    if (verify_engine != NULL) {
+        found = verifica_percorso(index, ws, dest, src);
+    } else {
+        found = planner_engine->plan(index, ws, dest, src);
+    }
+    if (!found) {
+        output_string(out, "nessun percorso\n");
+    } else {
+        stampa_tappe(out, ws, isForward);
+    }
+}
+
+// Prima posizione del blocco con distance >= distance
+int version_chunk_lower_bound(VersionChunk* chunk, int distance) {
+    int lo = 0, hi = chunk->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (chunk->distance[mid] < distance) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Blocco in cui sta, o andrebbe inserita, la stazione distance: l'ultimo che inizia
+// non dopo distance, oppure il primo
+int network_version_find_chunk(NetworkVersion* version, int distance) {
+    int lo = 0, hi = version->num_chunks;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (version->first[mid] <= distance) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo > 0 ? lo - 1 : 0;
+}
+
+// Copia in ws le stazioni della versione con distanza in [lower, upper] e le
+// restituisce come vista: i pianificatori sulla vista leggono solo la finestra tra
+// gli estremi, quindi non serve un array contiguo di tutta la rete
+StationArray network_version_window(NetworkVersion* version, RouteWorkspace* ws, int lower, int upper) {
+    StationArray view;
+    memset(&view, 0, sizeof(StationArray));
+    int count = 0;
+    for (int c = network_version_find_chunk(version, lower); c < version->num_chunks && version->first[c] <= upper; c++) {
+        VersionChunk* chunk = version->chunks[c];
+        int begin = version_chunk_lower_bound(chunk, lower);
+        int end = version_chunk_lower_bound(chunk, upper);
+        if (end < chunk->count && chunk->distance[end] == upper) {
+            end++;
+        }
+        if (end == begin) {
+            continue;
+        }
+        if (count + (end - begin) > ws->view_capacity) {
+            int capacity = ws->view_capacity > 0 ? ws->view_capacity : VERSION_CHUNK_STATIONS;
+            while (capacity < count + (end - begin)) {
+                capacity *= 2;
+            }
+            ws->view_distance = (int32_t*)realloc(ws->view_distance, capacity * sizeof(int32_t));
+            ws->view_reach = (int32_t*)realloc(ws->view_reach, capacity * sizeof(int32_t));
+            if (ws->view_distance == NULL || ws->view_reach == NULL) {
+                printf("Memory allocation failed\n");
+                exit(1);
+            }
+            ws->view_capacity = capacity;
+        }
+        memcpy(ws->view_distance + count, chunk->distance + begin, (end - begin) * sizeof(int32_t));
+        memcpy(ws->view_reach + count, chunk->max_reach + begin, (end - begin) * sizeof(int32_t));
+        count += end - begin;
+    }
+    view.enabled = true;
+    view.built = true;
+    view.version = version->version;
+    view.count = count;
+    view.capacity = ws->view_capacity;
+    view.distance = ws->view_distance;
+    view.max_reach = ws->view_reach;
+    return view;
+}
+
+// pianifica_percorso su una versione pubblicata dal server
+void pianifica_percorso_versione(OutputBuffer* out, NetworkVersion* version, RouteWorkspace* ws, int dest, int src) {
+    bool isForward = ordina_estremi(out, &dest, &src);
+    StationArray view = network_version_window(version, ws, dest, src);
+    int found = planner_engine->plan_array(&view, ws, dest, src);
+    if (!found) {
+        output_string(out, "nessun percorso\n");
+    } else {
+        stampa_tappe(out, ws, isForward);
+    }
+}
+
+// pianifica-percorsi partenza n arrivo1 ... arrivon: un pianifica-percorso dalla stessa
+// partenza verso ogni arrivo, con una sola ricerca per direzione sulla finestra delle
+// stazioni coinvolte (distance e reach come in StationArray, ordinate).
+// Gli arrivi dopo la partenza condividono l'inizio della finestra: uno sweep da
+// partenza etichetta ogni stazione col primo predecessore, come sweep_percorso, e
+// vale per tutti. Per quelli prima cambia l'inizio della finestra e quindi il primo
+// predecessore, cio la prima stazione da t in poi che raggiunge x: la si cerca in
+// una pila monotona dei record di reach da t verso destra, che cresce da destra a
+// sinistra. Ogni arrivo costa poi solo la ricostruzione delle tappe, O(log n)
+// ciascuna all'indietro.
+void pianifica_percorsi_finestra(OutputBuffer* out, RouteWorkspace* ws, const int32_t* distance, const int32_t* reach, int count, int partenza, const int* arrivi, int n) {
+    STATS_ADD(sweep_stations, count);
+    reserve_route_workspace(ws, count + 1);
+
+    int* pos = (int*)arena_alloc(&ws->arena, n * sizeof(int));              // Indice dell'arrivo, -1 se non c'
+    int* back_length = (int*)arena_alloc(&ws->arena, n * sizeof(int));      // Tappe all'indietro, 0 se nessun percorso
+    int** back_path = (int**)arena_alloc(&ws->arena, n * sizeof(int*));     // Da partenza all'arrivo
+    int* next_target = (int*)arena_alloc(&ws->arena, n * sizeof(int));      // Arrivi con lo stesso indice
+
+    int origin = count;
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (distance[mid] < partenza) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < count && distance[lo] == partenza) {
+        origin = lo;
+    }
+
+    int last = origin;
+    for (int i = 0; i < n; i++) {
+        pos[i] = -1;
+        back_length[i] = 0;
+        lo = 0;
+        hi = count;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (distance[mid] < arrivi[i]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (origin < count && lo < count && distance[lo] == arrivi[i]) {
+            pos[i] = lo;
+            if (lo > last) {
+                last = lo;
+            }
+        }
+    }
+    if (origin == count) {
+        last = -1;
+    }
+
+    // In avanti: ws->prev come in sweep_percorso, failed  la prima stazione che
+    // nessuna precedente raggiunge
+    int failed = last + 1;
+    int p = origin;
+    for (int j = origin + 1; j <= last; j++) {
+        while (p < j && reach[p] < distance[j]) {
+            p++;
+        }
+        if (p == j) {
+            failed = j;
+            break;
+        }
+        ws->prev[j] = p;
+    }
+
+    // All'indietro: gli arrivi si visitano per indice decrescente, raccolti in liste
+    if (origin > 0 && origin < count) {
+        int* first_target = (int*)arena_alloc(&ws->arena, origin * sizeof(int));
+        int* stack = (int*)arena_alloc(&ws->arena, (origin + 1) * sizeof(int));  // reach decrescenti dal fondo
+        memset(first_target, 0xff, origin * sizeof(int));
+        for (int i = 0; i < n; i++) {
+            if (pos[i] >= 0 && pos[i] < origin) {
+                next_target[i] = first_target[pos[i]];
+                first_target[pos[i]] = i;
+            }
+        }
+
+        stack[0] = origin;
+        int top = 1;
+        for (int t = origin - 1; t >= 0; t--) {
+            while (top > 0 && reach[stack[top - 1]] <= reach[t]) {
+                top--;
+            }
+            stack[top++] = t;
+
+            for (int i = first_target[t]; i != -1; i = next_target[i]) {
+                int length = 0;
+                int x = origin;
+                ws->path[length++] = distance[x];
+                while (x != t) {
+                    // Voce pi vicina alla cima con reach sufficiente
+                    int a = 0, b = top;
+                    while (a < b) {
+                        int mid = a + (b - a) / 2;
+                        if (reach[stack[mid]] >= distance[x]) {
+                            a = mid + 1;
+                        } else {
+                            b = mid;
+                        }
+                    }
+                    if (a == 0 || stack[a - 1] >= x) {
+                        length = 0;
+                        break;
+                    }
+                    x = stack[a - 1];
+                    ws->path[length++] = distance[x];
+                }
+                if (length > 0) {
+                    back_path[i] = (int*)arena_alloc(&ws->arena, length * sizeof(int));
+                    memcpy(back_path[i], ws->path, length * sizeof(int));
+                }
+                back_length[i] = length;
+            }
+        }
+    }
+
+    // Le risposte escono nell'ordine degli arrivi, come da pianifica_percorso
+    for (int i = 0; i < n; i++) {
+        int dest = arrivi[i];
+        int src = partenza;
+        bool isForward = ordina_estremi(out, &dest, &src);
+
+        int length = 0;
+        if (pos[i] >= origin && pos[i] < failed) {
+            for (int j = pos[i]; j != origin; j = ws->prev[j]) {
+                length++;
+            }
+            length++;
+            ws->path_length = length;
+            for (int j = pos[i]; length > 0; j = ws->prev[j]) {
+                ws->path[--length] = distance[j];
+            }
+            length = ws->path_length;
+        } else if (pos[i] >= 0 && pos[i] < origin) {
+            length = back_length[i];
+            for (int k = 0; k < length; k++) {
+                ws->path[k] = back_path[i][length - 1 - k];
+            }
+            ws->path_length = length;
+        }
+
+        if (length == 0) {
+            output_string(out, "nessun percorso\n");
+        } else {
+            stampa_tappe(out, ws, isForward);
+        }
+    }
+}
+
+void pianifica_percorsi(OutputBuffer* out, StationIndex* index, RouteWorkspace* ws, int partenza, const int* arrivi, int n) {
+    int first = partenza, last = partenza;
+    for (int i = 0; i < n; i++) {
+        if (arrivi[i] < first) {
+            first = arrivi[i];
+        }
+        if (arrivi[i] > last) {
+            last = arrivi[i];
+        }
+    }
+
+    arena_reset(&ws->arena);
+    if (index->array.enabled) {
+        // La vista aggiornata  gi la finestra
+        station_array_refresh(index);
+        StationArray* array = &index->array;
+        int lo = station_array_lower_bound(array, first);
+        int hi = station_array_lower_bound(array, last);
+        if (hi < array->count && array->distance[hi] == last) {
+            hi++;
+        }
+        pianifica_percorsi_finestra(out, ws, array->distance + lo, array->max_reach + lo, hi - lo, partenza, arrivi, n);
+        return;
+    }
+
+    int count = 0;
+    Station* station;
+    for (StationCursor it = station_lower_bound(index, first); (station = station_cursor_get(&it)) != NULL && station->distance <= last; station_cursor_next(&it)) {
+        if (count == ws->capacity) {
+            reserve_route_workspace(ws, count + 1);
+        }
+        ws->autonomy[count] = it.leaf->autonomy[it.pos];
+        ws->window[count++] = station;
+    }
+
+    int32_t* distance = (int32_t*)arena_alloc(&ws->arena, (count + 1) * sizeof(int32_t));
+    int32_t* reach = (int32_t*)arena_alloc(&ws->arena, (count + 1) * sizeof(int32_t));
+    for (int i = 0; i < count; i++) {
+        long long r = (long long)ws->window[i]->distance + ws->autonomy[i];
+        distance[i] = ws->window[i]->distance;
+        reach[i] = r > INT32_MAX ? INT32_MAX : (int32_t)r;
+    }
+    pianifica_percorsi_finestra(out, ws, distance, reach, count, partenza, arrivi, n);
+}
+
+// pianifica_percorsi su una versione pubblicata dal server
+void pianifica_percorsi_versione(OutputBuffer* out, NetworkVersion* version, RouteWorkspace* ws, int partenza, const int* arrivi, int n) {
+    int first = partenza, last = partenza;
+    for (int i = 0; i < n; i++) {
+        if (arrivi[i] < first) {
+            first = arrivi[i];
+        }
+        if (arrivi[i] > last) {
+            last = arrivi[i];
+        }
+    }
+
+    arena_reset(&ws->arena);
+    StationArray view = network_version_window(version, ws, first, last);
+    pianifica_percorsi_finestra(out, ws, view.distance, view.max_reach, view.count, partenza, arrivi, n);
+}
+
+void init_route_cache(RouteCache* cache, int capacity, size_t max_bytes) {
+    int buckets = 1;
+    while (buckets < 2 * capacity) {
+        buckets *= 2;
+    }
+
+    cache->entries = (RouteCacheEntry*)malloc(capacity * sizeof(RouteCacheEntry));
+    cache->buckets = (int*)malloc(buckets * sizeof(int));
+    if (cache->entries == NULL || cache->buckets == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < buckets; i++) {
+        cache->buckets[i] = -1;
+    }
+
+    cache->bucket_mask = buckets - 1;
+    cache->capacity = capacity;
+    cache->used = 0;
+    cache->free_head = -1;
+    cache->lru_head = -1;
+    cache->lru_tail = -1;
+    cache->bytes = 0;
+    cache->max_bytes = max_bytes;
+}
+
+void free_route_cache(RouteCache* cache) {
+    for (int i = cache->lru_head; i != -1; i = cache->entries[i].lru_next) {
+        free(cache->entries[i].text);
+    }
+    free(cache->entries);
+    free(cache->buckets);
+}
+
+int route_cache_bucket(RouteCache* cache, int partenza, int arrivo) {
+    unsigned int h = (unsigned int)partenza * 0x9E3779B1u ^ (unsigned int)arrivo * 0x85EBCA77u;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 13;
+    return (int)(h & (unsigned int)cache->bucket_mask);
+}
+
+void route_cache_unlink_lru(RouteCache* cache, int i) {
+    RouteCacheEntry* entry = &cache->entries[i];
+    if (entry->lru_prev != -1) {
+        cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != -1) {
+        cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+}
+
+void route_cache_push_front(RouteCache* cache, int i) {
+    RouteCacheEntry* entry = &cache->entries[i];
+    entry->lru_prev = -1;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head != -1) {
+        cache->entries[cache->lru_head].lru_prev = i;
+    } else {
+        cache->lru_tail = i;
+    }
+    cache->lru_head = i;
+}
+
+// Sfratta la voce usata meno di recente e la mette nella lista libera
+void route_cache_evict_lru(RouteCache* cache) {
+    int i = cache->lru_tail;
+    RouteCacheEntry* entry = &cache->entries[i];
+
+    int* link = &cache->buckets[route_cache_bucket(cache, entry->partenza, entry->arrivo)];
+    while (*link != i) {
+        link = &cache->entries[*link].bucket_next;
+    }
+    *link = entry->bucket_next;
+
+    route_cache_unlink_lru(cache, i);
+    cache->bytes -= entry->length;
+    free(entry->text);
+    entry->text = NULL;
+    entry->bucket_next = cache->free_head;
+    cache->free_head = i;
+}
+
+// Una voce resta valida se nessuna modifica successiva riguarda il suo intervallo:
+// le stazioni aggiunte o demolite contano in [lo, hi], le variazioni di autonomia
+// massima solo in [lo, hi) perch da hi non parte nessun salto del percorso
+bool route_cache_entry_valid(StationIndex* index, RouteCacheEntry* entry) {
+    if (entry->version == index->route_version) {
+        return true;
+    }
+    if (index->route_version - entry->version > ROUTE_CHANGE_LOG_SIZE) {
+        return false;
+    }
+
+    int lo = entry->partenza < entry->arrivo ? entry->partenza : entry->arrivo;
+    int hi = entry->partenza < entry->arrivo ? entry->arrivo : entry->partenza;
+    for (unsigned long long v = entry->version + 1; v <= index->route_version; v++) {
+        RouteChange* change = &index->route_changes[v % ROUTE_CHANGE_LOG_SIZE];
+        if (change->distance >= lo && (change->distance < hi || (change->endpoint && change->distance == hi))) {
+            return false;
+        }
+    }
+
+    // Le modifiche controllate non vanno riesaminate alla prossima richiesta
+    entry->version = index->route_version;
+    return true;
+}
+
+// Cerca la risposta memorizzata per (partenza, arrivo): restituisce la voce se 
+// ancora valida, portandola in testa alla LRU, altrimenti -1
+int route_cache_lookup(RouteCache* cache, StationIndex* index, int partenza, int arrivo) {
+    int i = cache->buckets[route_cache_bucket(cache, partenza, arrivo)];
+    while (i != -1 && (cache->entries[i].partenza != partenza || cache->entries[i].arrivo != arrivo)) {
+        i = cache->entries[i].bucket_next;
+    }
+
+    if (i == -1 || !route_cache_entry_valid(index, &cache->entries[i])) {
+        return -1;
+    }
+    route_cache_unlink_lru(cache, i);
+    route_cache_push_front(cache, i);
+    return i;
+}
+
+// Memorizza la risposta appena calcolata per (partenza, arrivo), sostituendo
+// un'eventuale voce scaduta con la stessa chiave
+void route_cache_store(RouteCache* cache, StationIndex* index, int partenza, int arrivo, const char* data, size_t length) {
+    // Le risposte pi grandi del budget non vengono memorizzate
+    if (length > cache->max_bytes) {
+        return;
+    }
+
+    int bucket = route_cache_bucket(cache, partenza, arrivo);
+    int i = cache->buckets[bucket];
+    while (i != -1 && (cache->entries[i].partenza != partenza || cache->entries[i].arrivo != arrivo)) {
+        i = cache->entries[i].bucket_next;
+    }
+
+    char* text = (char*)malloc(length);
+    if (text == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    memcpy(text, data, length);
+
+    if (i != -1) {
+        // Voce scaduta: viene aggiornata al suo posto
+        route_cache_unlink_lru(cache, i);
+        cache->bytes -= cache->entries[i].length;
+        free(cache->entries[i].text);
+    } else {
+        if (cache->free_head == -1 && cache->used == cache->capacity) {
+            route_cache_evict_lru(cache);
+        }
+        if (cache->free_head != -1) {
+            i = cache->free_head;
+            cache->free_head = cache->entries[i].bucket_next;
+        } else {
+            i = cache->used++;
+        }
+        cache->entries[i].partenza = partenza;
+        cache->entries[i].arrivo = arrivo;
+        cache->entries[i].bucket_next = cache->buckets[bucket];
+        cache->buckets[bucket] = i;
+    }
+
+    cache->entries[i].version = index->route_version;
+    cache->entries[i].text = text;
+    cache->entries[i].length = length;
+    cache->bytes += length;
+    route_cache_push_front(cache, i);
+
+    while (cache->bytes > cache->max_bytes && cache->lru_tail != i) {
+        route_cache_evict_lru(cache);
+    }
+}
+
+// Percorsi registrati. Le etichette sono quelle di sweep_percorso: prev[j]  la
+// prima stazione della finestra che raggiunge j. Una modifica alla stazione q cambia
+// solo le etichette successive, e appena un'etichetta ricalcolata oltre la stazione
+// modificata coincide con quella vecchia anche tutte le seguenti restano uguali.
+
+void subscription_reserve(RouteSubscription* sub, int count) {
+    int old_capacity = sub->ws.capacity;
+    reserve_route_workspace(&sub->ws, count);
+    if (sub->ws.capacity != old_capacity) {
+        sub->distance = (int*)realloc(sub->distance, sub->ws.capacity * sizeof(int));
+        if (sub->distance == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+    }
+}
+
+// Ricalcola le etichette da first in poi; changed  la prima stazione i cui dati
+// possono essere cambiati. Le etichette prima di first devono essere valide.
+void subscription_repair(RouteSubscription* sub, int first, int changed) {
+    int old_failed = sub->failed;
+    int p = 0;
+    if (first == 0) {
+        sub->ws.prev[0] = -1;
+        first = 1;
+    } else if (sub->ws.prev[first - 1] > 0) {
+        p = sub->ws.prev[first - 1];
+    }
+
+    sub->failed = sub->count;
+    for (int j = first; j < sub->count; j++) {
+        int target = sub->distance[j];
+        while (p < j && target - sub->distance[p] > sub->ws.autonomy[p]) {
+            p++;
+        }
+        if (p == j) {
+            // Da qui in poi nessuna stazione  raggiungibile
+            sub->failed = j;
+            return;
+        }
+        if (p >= changed && j < old_failed && sub->ws.prev[j] == p) {
+            sub->failed = old_failed;
+            return;
+        }
+        sub->ws.prev[j] = p;
+    }
+}
+
+// Formatta la risposta come pianifica_percorso
+void subscription_render(RouteSubscription* sub) {
+    OutputBuffer* out = &sub->text;
+    int lo = sub->partenza < sub->arrivo ? sub->partenza : sub->arrivo;
+    int hi = sub->partenza < sub->arrivo ? sub->arrivo : sub->partenza;
+
+    out->length = 0;
+    if (sub->partenza == sub->arrivo) {
+        output_int(out, sub->partenza);
+        output_string(out, " \n");
+    }
+
+    if (sub->count == 0 || sub->distance[0] != lo || sub->distance[sub->count - 1] != hi || sub->failed != sub->count) {
+        output_string(out, "nessun percorso\n");
+    } else {
+        int length = 0;
+        for (int j = sub->count - 1; j != -1; j = sub->ws.prev[j]) {
+            length++;
+        }
+        sub->ws.path_length = length;
+        for (int j = sub->count - 1; j != -1; j = sub->ws.prev[j]) {
+            sub->ws.path[--length] = sub->distance[j];
+        }
+        stampa_tappe(out, &sub->ws, sub->arrivo > sub->partenza);
+    }
+    sub->dirty = false;
+}
+
+void init_route_subscriptions(RouteSubscriptions* subs) {
+    subs->items = NULL;
+    subs->count = 0;
+    subs->capacity = 0;
+    subs->version = 0;
+}
+
+void free_route_subscriptions(RouteSubscriptions* subs) {
+    for (int i = 0; i < subs->count; i++) {
+        free_route_workspace(&subs->items[i].ws);
+        free(subs->items[i].distance);
+        output_free(&subs->items[i].text);
+    }
+    free(subs->items);
+}
+
+// Posizione della prima iscrizione con chiave (partenza, arrivo) non minore di quella data
+int route_subscription_position(RouteSubscriptions* subs, int partenza, int arrivo) {
+    int lo = 0, hi = subs->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        RouteSubscription* sub = &subs->items[mid];
+        if (sub->partenza < partenza || (sub->partenza == partenza && sub->arrivo < arrivo)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int route_subscription_find(RouteSubscriptions* subs, int partenza, int arrivo) {
+    int i = route_subscription_position(subs, partenza, arrivo);
+    if (i < subs->count && subs->items[i].partenza == partenza && subs->items[i].arrivo == arrivo) {
+        return i;
+    }
+    return -1;
+}
+
+// registra-percorso: la finestra e le etichette del percorso restano in memoria.
+// Restituisce 0 se il percorso era gi registrato. Con --server non c': la
+// risposta  "non supportato".
+int register_route(RouteSubscriptions* subs, StationIndex* index, int partenza, int arrivo) {
+    int i = route_subscription_position(subs, partenza, arrivo);
+    if (i < subs->count && subs->items[i].partenza == partenza && subs->items[i].arrivo == arrivo) {
+        return 0;
+    }
+
+    if (subs->count == subs->capacity) {
+        subs->capacity = subs->capacity > 0 ? subs->capacity * 2 : 16;
+        subs->items = (RouteSubscription*)realloc(subs->items, subs->capacity * sizeof(RouteSubscription));
+        if (subs->items == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    memmove(&subs->items[i + 1], &subs->items[i], (subs->count - i) * sizeof(RouteSubscription));
+    subs->count++;
+
+    RouteSubscription* sub = &subs->items[i];
+    memset(sub, 0, sizeof(RouteSubscription));
+    sub->partenza = partenza;
+    sub->arrivo = arrivo;
+    output_init(&sub->text, -1);
+
+    int lo = partenza < arrivo ? partenza : arrivo;
+    int hi = partenza < arrivo ? arrivo : partenza;
+    Station* station;
+    for (StationCursor it = station_lower_bound(index, lo); (station = station_cursor_get(&it)) != NULL && station->distance <= hi; station_cursor_next(&it)) {
+        subscription_reserve(sub, sub->count + 1);
+        sub->ws.autonomy[sub->count] = get_max_autonomy_auto(&station->fleet);
+        sub->distance[sub->count] = station->distance;
+        sub->count++;
+    }
+    if (sub->count > 0) {
+        subscription_repair(sub, 0, 0);
+    }
+    sub->dirty = true;
+    return 1;
+}
+
+// Porta la stazione in posizione distance allo stato attuale dell'indice in un
+// percorso registrato. Si confronta la finestra con l'indice invece di seguire il
+// tipo della modifica: dopo un log applicato in blocco la stazione pu essere stata
+// demolita e aggiunta di nuovo, o avere altre auto, rispetto alla modifica registrata.
+void subscription_apply_change(RouteSubscription* sub, StationIndex* index, int distance) {
+    int q = 0, hi = sub->count;
+    while (q < hi) {
+        int mid = q + (hi - q) / 2;
+        if (sub->distance[mid] < distance) {
+            q = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    bool present = q < sub->count && sub->distance[q] == distance;
+    Station* station = search_station(index, distance);
+
+    int first, changed;
+    if (station != NULL && present) {
+        // Cambia al pi l'autonomia massima: contano solo le etichette successive
+        int autonomy = get_max_autonomy_auto(&station->fleet);
+        if (autonomy == sub->ws.autonomy[q]) {
+            return;
+        }
+        sub->ws.autonomy[q] = autonomy;
+        first = q + 1;
+        changed = q + 1;
+    } else if (station != NULL) {
+        subscription_reserve(sub, sub->count + 1);
+        int tail = sub->count - q;
+        memmove(&sub->ws.autonomy[q + 1], &sub->ws.autonomy[q], tail * sizeof(int32_t));
+        memmove(&sub->distance[q + 1], &sub->distance[q], tail * sizeof(int));
+        memmove(&sub->ws.prev[q + 1], &sub->ws.prev[q], tail * sizeof(int));
+        sub->ws.autonomy[q] = get_max_autonomy_auto(&station->fleet);
+        sub->distance[q] = distance;
+        sub->count++;
+        for (int j = q + 1; j < sub->count; j++) {
+            if (sub->ws.prev[j] >= q) {
+                sub->ws.prev[j]++;
+            }
+        }
+        if (sub->failed >= q) {
+            sub->failed++;
+        }
+        first = q;
+        changed = q + 1;
+    } else if (present) {
+        int tail = sub->count - q - 1;
+        memmove(&sub->ws.autonomy[q], &sub->ws.autonomy[q + 1], tail * sizeof(int32_t));
+        memmove(&sub->distance[q], &sub->distance[q + 1], tail * sizeof(int));
+        memmove(&sub->ws.prev[q], &sub->ws.prev[q + 1], tail * sizeof(int));
+        sub->count--;
+        for (int j = q; j < sub->count; j++) {
+            if (sub->ws.prev[j] > q) {
+                sub->ws.prev[j]--;
+            } else if (sub->ws.prev[j] == q) {
+                // Il predecessore  stato demolito: l'etichetta non vale pi
+                sub->ws.prev[j] = -2;
+            }
+        }
+        if (sub->failed > q) {
+            sub->failed--;
+        }
+        first = q;
+        changed = q;
+    } else {
+        return;
+    }
+
+    if (first < sub->count && first <= sub->failed) {
+        subscription_repair(sub, first, changed);
+    }
+    sub->dirty = true;
+}
+
+// Porta i percorsi registrati alla versione corrente dell'indice: ogni modifica
+// ripara solo i percorsi il cui intervallo la contiene, con le stesse regole
+// di route_cache_entry_valid
+void update_route_subscriptions(RouteSubscriptions* subs, StationIndex* index) {
+    if (index->route_version - subs->version > ROUTE_CHANGE_LOG_SIZE) {
+        // Il log non copre tutte le modifiche: si ripete la registrazione
+        RouteSubscriptions old = *subs;
+        init_route_subscriptions(subs);
+        for (int i = 0; i < old.count; i++) {
+            register_route(subs, index, old.items[i].partenza, old.items[i].arrivo);
+        }
+        free_route_subscriptions(&old);
+        subs->version = index->route_version;
+        return;
+    }
+
+    for (unsigned long long v = subs->version + 1; v <= index->route_version; v++) {
+        RouteChange* change = &index->route_changes[v % ROUTE_CHANGE_LOG_SIZE];
+        for (int i = 0; i < subs->count; i++) {
+            RouteSubscription* sub = &subs->items[i];
+            int lo = sub->partenza < sub->arrivo ? sub->partenza : sub->arrivo;
+            int hi = sub->partenza < sub->arrivo ? sub->arrivo : sub->partenza;
+            if (change->distance >= lo && (change->distance < hi || (change->endpoint && change->distance == hi))) {
+                subscription_apply_change(sub, index, change->distance);
+            }
+        }
+    }
+    subs->version = index->route_version;
+}
+
+// Il pool esegue i pianifica-percorso del batch corrente: ogni worker prende la
+// prossima richiesta libera e formatta la risposta nel proprio buffer
+void run_query_batch(QueryPool* pool, QueryWorker* worker) {
+    int i;
+    while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+        RouteQuery* query = &pool->queries[i];
+        if (query->subscription != -1 || query->cache_entry != -1) {
+            continue;
+        }
+        STATS_TIMER_START(timer);
+        query->worker = worker->id;
+        query->offset = worker->output.length;
+        pianifica_percorso(&worker->output, pool->index, &worker->workspace, query->arrivo, query->partenza);
+        query->length = worker->output.length - query->offset;
+        STATS_INC(route_queries);
+        STATS_TIMER_STOP(timer, CMD_PIANIFICA_PERCORSO);
+    }
+}
+
+void* query_worker_main(void* arg) {
+    QueryWorker* worker = (QueryWorker*)arg;
+    QueryPool* pool = worker->pool;
+    unsigned long seen = 0;
+
+#ifdef PLAN_ROUTE_STATS
+    // SIGUSR1 deve arrivare al thread principale, che pu essere fermo in una read
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+#endif
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->work_ready, &pool->mutex);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->mutex);
+
+        run_query_batch(pool, worker);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+// Il thread principale  il worker 0: con num_workers == 1 non parte nessun thread
+void init_query_pool(QueryPool* pool, int num_workers) {
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+    pool->num_workers = num_workers;
+    pool->workers = (QueryWorker*)calloc(num_workers, sizeof(QueryWorker));
+    pool->threads = (pthread_t*)malloc(num_workers * sizeof(pthread_t));
+    if (pool->workers == NULL || pool->threads == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->generation = 0;
+    pool->busy = 0;
+    pool->shutdown = false;
+    pool->index = NULL;
+    pool->queries = NULL;
+    pool->count = 0;
+    atomic_init(&pool->next, 0);
+
+    for (int i = 0; i < num_workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        output_init(&pool->workers[i].output, -1);
+    }
+    for (int i = 1; i < num_workers; i++) {
+        if (pthread_create(&pool->threads[i], NULL, query_worker_main, &pool->workers[i]) != 0) {
+            // Si prosegue con i thread gi avviati
+            pool->num_workers = i;
+            break;
+        }
+    }
+}
+
+void free_query_pool(QueryPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 1; i < pool->num_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i < pool->num_workers; i++) {
+        output_free(&pool->workers[i].output);
+        free_route_workspace(&pool->workers[i].workspace);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->workers);
+    free(pool->threads);
+}
+
+// Esegue un batch di pianifica-percorso consecutivi, che non modificano l'indice.
+// Le risposte in cache vengono individuate prima, le altre calcolate in parallelo;
+// poi tutto viene scritto nell'ordine dell'input e solo alla fine le risposte
+// nuove entrano in cache, cos nessuna voce del batch viene sfrattata prima dell'uso.
+void execute_query_batch(QueryPool* pool, RouteSubscriptions* subs, RouteCache* cache, OutputBuffer* out, StationIndex* index, RouteQuery* queries, int count) {
+    int misses = 0;
+    for (int i = 0; i < count; i++) {
+        STATS_TIMER_START(timer);
+        queries[i].subscription = route_subscription_find(subs, queries[i].partenza, queries[i].arrivo);
+        queries[i].cache_entry = -1;
+        if (queries[i].subscription != -1) {
+            if (subs->items[queries[i].subscription].dirty) {
+                subscription_render(&subs->items[queries[i].subscription]);
+            }
+            STATS_INC(subscription_hits);
+            STATS_TIMER_STOP(timer, CMD_PIANIFICA_PERCORSO);
+            continue;
+        }
+        if (cache != NULL) {
+            queries[i].cache_entry = route_cache_lookup(cache, index, queries[i].partenza, queries[i].arrivo);
+        }
+        if (queries[i].cache_entry == -1) {
+            misses++;
+        } else {
+            STATS_INC(cache_hits);
+            STATS_TIMER_STOP(timer, CMD_PIANIFICA_PERCORSO);
+        }
+    }
+    for (int i = 0; i < pool->num_workers; i++) {
+        pool->workers[i].output.length = 0;
+    }
+
+    // L'indice a salti e la vista si aggiornano qui, prima che i worker li leggano
+    if (index->jump.enabled) {
+        jump_index_refresh(index);
+    }
+    if (index->array.enabled) {
+        station_array_refresh(index);
+    }
+
+    pool->index = index;
+    pool->queries = queries;
+    pool->count = count;
+    atomic_store(&pool->next, 0);
+
+    // Un motore che scrive nelle stazioni, come dijkstra, resta sequenziale
+    if (pool->num_workers > 1 && misses > 1 && planner_engines_parallel()) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->busy = pool->num_workers - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->work_ready);
+        pthread_mutex_unlock(&pool->mutex);
+
+        run_query_batch(pool, &pool->workers[0]);
+
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->busy > 0) {
+            pthread_cond_wait(&pool->work_done, &pool->mutex);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    } else if (misses > 0) {
+        run_query_batch(pool, &pool->workers[0]);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (queries[i].subscription != -1) {
+            OutputBuffer* text = &subs->items[queries[i].subscription].text;
+            output_bytes(out, text->data, text->length);
+        } else if (queries[i].cache_entry != -1) {
+            RouteCacheEntry* entry = &cache->entries[queries[i].cache_entry];
+            output_bytes(out, entry->text, entry->length);
+        } else {
+            OutputBuffer* rendered = &pool->workers[queries[i].worker].output;
+            output_bytes(out, rendered->data + queries[i].offset, queries[i].length);
+        }
+    }
+
+    if (cache != NULL) {
+        for (int i = 0; i < count; i++) {
+            if (queries[i].subscription == -1 && queries[i].cache_entry == -1) {
+                OutputBuffer* rendered = &pool->workers[queries[i].worker].output;
+                route_cache_store(cache, index, queries[i].partenza, queries[i].arrivo, rendered->data + queries[i].offset, queries[i].length);
+            }
+        }
+    }
+}
+
+// pianifica-percorsi con un motore senza ricerca unica, o in verifica: ogni arrivo
+// diventa un pianifica-percorso del batch e passa dal motore. In verifica anche le
+// righe della ricerca unica devono essere uguali.
+void pianifica_percorsi_espansi(QueryPool* pool, RouteSubscriptions* subs, RouteCache* cache, OutputBuffer* out, StationIndex* index, RouteQuery* batch, int partenza, const int* arrivi, int n) {
+    OutputBuffer expanded;
+    output_init(&expanded, -1);
+    for (int i = 0; i < n; i += QUERY_BATCH_MAX) {
+        int count = n - i < QUERY_BATCH_MAX ? n - i : QUERY_BATCH_MAX;
+        for (int k = 0; k < count; k++) {
+            batch[k].partenza = partenza;
+            batch[k].arrivo = arrivi[i + k];
+        }
+        execute_query_batch(pool, subs, cache, &expanded, index, batch, count);
+    }
+
+    if (verify_engine != NULL) {
+        OutputBuffer single;
+        output_init(&single, -1);
+        pianifica_percorsi(&single, index, &pool->workers[0].workspace, partenza, arrivi, n);
+        if (single.length != expanded.length || memcmp(single.data, expanded.data, single.length) != 0) {
+            fprintf(stderr, "pianifica-percorsi da %d: la ricerca unica non coincide con %s e %s\n",
+                    partenza, planner_engine->name, verify_engine->name);
+            exit(1);
+        }
+        output_free(&single);
+    }
+
+    output_bytes(out, expanded.data, expanded.length);
+    output_free(&expanded);
+}
+
+// Snapshot binario della rete: intestazione, stazioni ordinate per distanza e
+// autonomie di tutti i parchi auto, nel formato nativo della macchina. Il checksum
+// dell'intestazione copre anche la versione, quindi un file di un'altra versione
+// o con un altro ordine dei byte viene rifiutato.
+
+uint64_t snapshot_checksum(uint64_t hash, const void* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0x100000001B3ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+uint64_t snapshot_header_checksum(SnapshotHeader* header) {
+    return snapshot_checksum(SNAPSHOT_CHECKSUM_SEED, header, offsetof(SnapshotHeader, header_checksum));
+}
+
+// Scrive lo snapshot in un file temporaneo e lo rinomina: un salvataggio
+// interrotto non lascia mai un file a met
+bool save_snapshot(StationIndex* index, const char* path) {
+    size_t path_length = strlen(path);
+    char* temp_path = (char*)malloc(path_length + 5);
+    if (temp_path == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    memcpy(temp_path, path, path_length);
+    memcpy(temp_path + path_length, ".tmp", 5);
+
+    FILE* file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        free(temp_path);
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.header_size = sizeof(SnapshotHeader);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // Prima le stazioni, con la posizione del loro parco auto, poi le autonomie
+    uint64_t hash = SNAPSHOT_CHECKSUM_SEED;
+    uint64_t items = 0;
+    Station* station;
+    for (StationCursor it = station_first(index); ok && (station = station_cursor_get(&it)) != NULL; station_cursor_next(&it)) {
+        SnapshotStation record = { station->distance, (uint32_t)station->fleet.size, items };
+        ok = fwrite(&record, sizeof(record), 1, file) == 1;
+        hash = snapshot_checksum(hash, &record, sizeof(record));
+        items += station->fleet.size;
+        header.station_count++;
+    }
+    for (StationCursor it = station_first(index); ok && (station = station_cursor_get(&it)) != NULL; station_cursor_next(&it)) {
+        size_t bytes = station->fleet.size * sizeof(AutoCount);
+        ok = fwrite(fleet_items(&station->fleet), 1, bytes, file) == bytes;
+        hash = snapshot_checksum(hash, fleet_items(&station->fleet), bytes);
+    }
+
+    header.item_count = items;
+    header.body_checksum = hash;
+    header.header_checksum = snapshot_header_checksum(&header);
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(temp_path, path) == 0;
+    if (!ok) {
+        remove(temp_path);
+    }
+    free(temp_path);
+    return ok;
+}
+
+// Carica lo snapshot in un indice vuoto. Il file viene mappato e verificato per
+// intero prima di creare le stazioni, poi il B+tree si costruisce dal basso con
+// btree_bulk_build: nessun inserimento, nessuna discesa nell'albero.
+bool load_snapshot(StationIndex* index, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t length = st.st_size;
+    char* data = (char*)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    madvise(data, length, MADV_SEQUENTIAL);
+
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool ok = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+              header.header_checksum == snapshot_header_checksum(&header) &&
+              header.version == SNAPSHOT_VERSION && header.header_size == sizeof(SnapshotHeader) &&
+              header.station_count <= INT_MAX &&
+              header.item_count <= (length - sizeof(SnapshotHeader)) / sizeof(AutoCount) &&
+              header.station_count <= (length - sizeof(SnapshotHeader)) / sizeof(SnapshotStation) &&
+              length == sizeof(SnapshotHeader) + header.station_count * sizeof(SnapshotStation) + header.item_count * sizeof(AutoCount);
+
+    const SnapshotStation* records = (const SnapshotStation*)(data + sizeof(SnapshotHeader));
+    const AutoCount* items = (const AutoCount*)(records + (ok ? header.station_count : 0));
+    ok = ok && snapshot_checksum(SNAPSHOT_CHECKSUM_SEED, records, length - sizeof(SnapshotHeader)) == header.body_checksum;
+
+    // Lo stesso controllo di coerenza che garantiscono gli inserimenti
+    uint64_t next_item = 0;
+    for (uint64_t s = 0; ok && s < header.station_count; s++) {
+        ok = records[s].fleet_offset == next_item && records[s].fleet_size <= header.item_count - next_item &&
+             (s == 0 || records[s].distance > records[s - 1].distance);
+        for (uint32_t k = 0; ok && k < records[s].fleet_size; k++) {
+            const AutoCount* item = &items[next_item + k];
+            ok = item->count > 0 && (k == 0 || item->autonomy > item[-1].autonomy);
+        }
+        next_item += records[s].fleet_size;
+    }
+    ok = ok && next_item == header.item_count;
+
+    if (!ok || index->root != NULL) {
+        munmap(data, length);
+        return false;
+    }
+
+    int count = (int)header.station_count;
+    Station** stations = (Station**)malloc((count > 0 ? count : 1) * sizeof(Station*));
+    if (stations == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    for (int s = 0; s < count; s++) {
+        Station* station = create_station(index, records[s].distance);
+        int size = (int)records[s].fleet_size;
+        fleet_reserve(index, &station->fleet, size);
+        memcpy(fleet_items(&station->fleet), &items[records[s].fleet_offset], size * sizeof(AutoCount));
+        station->fleet.size = size;
+        stations[s] = station;
+    }
+    btree_bulk_build(index, stations, count);
+
+    free(stations);
+    munmap(data, length);
+    return true;
+}
+
+// Le stazioni, i nodi e le flotte vivono nelle slab: basta rilasciare quelle
+void free_station_index(StationIndex* index) {
+    slab_release_all(&index->station_pool);
+    slab_release_all(&index->node_pool);
+    for (int c = 0; c < FLEET_SIZE_CLASSES; c++) {
+        slab_release_all(&index->fleet_pools[c]);
+    }
+    free(index->jump.distance);
+    free(index->jump.reach);
+    for (int k = 0; k < index->jump.levels; k++) {
+        free(index->jump.jump[k]);
+        free(index->jump.range_max[k]);
+    }
+    free(index->array.distance);
+    free(index->array.max_reach);
+    index->root = NULL;
+    index->size = 0;
+}
+
+// Legge a blocchi da un descrittore gi aperto, che input_close chiude se non 
+// lo standard input
+void input_open_fd(InputReader* in, int fd) {
+    in->fd = fd;
+    in->length = 0;
+    in->pos = 0;
+    in->mapped = false;
+    in->eof = false;
+    in->flush_before_read = NULL;
+    in->max_list = 0;
+    in->capacity = INPUT_BLOCK_SIZE;
+    in->data = (char*)malloc(in->capacity);
+    if (in->data == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+}
+
+// Apre l'input: il file indicato viene mappato in memoria, altrimenti si legge a
+// blocchi dallo standard input (o dal file, se non  mappabile)
+void input_open(InputReader* in, const char* path) {
+    int fd = STDIN_FILENO;
+
+    if (path != NULL) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Impossibile aprire %s\n", path);
+            exit(1);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, st.st_size, MADV_SEQUENTIAL);
+                in->fd = fd;
+                in->data = (char*)data;
+                in->length = st.st_size;
+                in->pos = 0;
+                in->capacity = st.st_size;
+                in->mapped = true;
+                in->eof = true;
+                in->flush_before_read = NULL;
+                in->max_list = 0;
+                return;
+            }
+        }
+    }
+
+    input_open_fd(in, fd);
+}
+
+void input_close(InputReader* in) {
+    if (in->mapped) {
+        munmap(in->data, in->capacity);
+    } else {
+        free(in->data);
+    }
+    if (in->fd != STDIN_FILENO) {
+        close(in->fd);
+    }
+}
+
+// Sposta in testa al buffer i byte non consumati e legge il blocco successivo.
+// Restituisce false se non sono arrivati nuovi dati.
+bool input_refill(InputReader* in) {
+    if (in->eof) {
+        return false;
+    }
+
+    size_t remaining = in->length - in->pos;
+    memmove(in->data, in->data + in->pos, remaining);
+    in->length = remaining;
+    in->pos = 0;
+
+    // Un token pi lungo di un blocco: il buffer raddoppia
+    if (in->length == in->capacity) {
+        in->capacity *= 2;
+        in->data = (char*)realloc(in->data, in->capacity);
+        if (in->data == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+    }
+
+    // Chi scrive un comando alla volta deve ricevere le risposte prima di mandare il successivo
+    if (in->flush_before_read != NULL) {
+        output_flush(in->flush_before_read);
+    }
+
+    ssize_t n;
+    do {
+        n = read(in->fd, in->data + in->length, in->capacity - in->length);
+        if (n < 0 && errno == EINTR) {
+            // Un SIGUSR1 arrivato mentre si attende l'input
+            STATS_POLL();
+        }
+    } while (n < 0 && errno == EINTR);
+    STATS_INC(input_refills);
+
+    if (n <= 0) {
+        in->eof = true;
+        return false;
+    }
+    STATS_ADD(input_bytes, n);
+    in->length += n;
+    return true;
+}
+
+bool is_input_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Salta gli spazi; restituisce false a fine input
+bool input_skip_spaces(InputReader* in) {
+    for (;;) {
+        while (in->pos < in->length && is_input_space(in->data[in->pos])) {
+            in->pos++;
+        }
+        if (in->pos < in->length) {
+            return true;
+        }
+        if (!input_refill(in)) {
+            return false;
+        }
+    }
+}
+
+// Vero se il buffer contiene gi l'inizio di un altro token, senza leggere dal descrittore
+bool input_pending(InputReader* in) {
+    while (in->pos < in->length && is_input_space(in->data[in->pos])) {
+        in->pos++;
+    }
+    return in->pos < in->length;
+}
+
+// Legge il prossimo token senza copiarlo: il puntatore resta valido fino alla
+// lettura successiva
+bool input_token(InputReader* in, const char** token, size_t* length) {
+    if (!input_skip_spaces(in)) {
+        return false;
+    }
+
+    size_t end = in->pos;
+    for (;;) {
+        while (end < in->length && !is_input_space(in->data[end])) {
+            end++;
+        }
+        if (end < in->length) {
+            break;
+        }
+
+        // Il token prosegue nel blocco successivo
+        size_t offset = end - in->pos;
+        bool more = input_refill(in);
+        end = in->pos + offset;
+        if (!more) {
+            break;
+        }
+    }
+
+    *token = in->data + in->pos;
+    *length = end - in->pos;
+    in->pos = end;
+    return true;
+}
+
+// Legge un intero con segno come scanf("%d"); restituisce false se manca
+bool input_int(InputReader* in, int* value) {
+    if (!input_skip_spaces(in)) {
+        return false;
+    }
+
+    // Se l'intero arriva alla fine del buffer pu proseguire nel blocco successivo:
+    // si legge altro solo in quel caso, per non bloccarsi su un input interattivo
+    for (;;) {
+        size_t i = in->pos;
+        if (i < in->length && (in->data[i] == '-' || in->data[i] == '+')) {
+            i++;
+        }
+        while (i < in->length && in->data[i] >= '0' && in->data[i] <= '9') {
+            i++;
+        }
+        if (i < in->length || !input_refill(in)) {
+            break;
+        }
+    }
+
+    const char* p = in->data + in->pos;
+    const char* end = in->data + in->length;
+    bool negative = false;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return false;
+    }
+
+    unsigned int result = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        result = result * 10 + (unsigned int)(*p - '0');
+        p++;
+    }
+
+    *value = negative ? (int)(0u - result) : (int)result;
+    in->pos = p - in->data;
+    return true;
+}
+
+// Riconosce il comando dalla lunghezza e, a parit di lunghezza, dal primo carattere
+CommandType parse_command(const char* token, size_t length) {
+    switch (length) {
+    case 12:
+        if (memcmp(token, "rottama-auto", 12) == 0) {
+            return CMD_ROTTAMA_AUTO;
+        }
+        break;
+    case 13:
+        if (memcmp(token, "aggiungi-auto", 13) == 0) {
+            return CMD_AGGIUNGI_AUTO;
+        }
+        break;
+    case 17:
+        if (token[0] == 'a' && memcmp(token, "aggiungi-stazione", 17) == 0) {
+            return CMD_AGGIUNGI_STAZIONE;
+        }
+        if (token[0] == 'r' && memcmp(token, "registra-percorso", 17) == 0) {
+            return CMD_REGISTRA_PERCORSO;
+        }
+        break;
+    case 18:
+        if (token[0] == 'd' && memcmp(token, "demolisci-stazione", 18) == 0) {
+            return CMD_DEMOLISCI_STAZIONE;
+        }
+        if (token[0] == 'p' && memcmp(token, "pianifica-percorso", 18) == 0) {
+            return CMD_PIANIFICA_PERCORSO;
+        }
+        if (token[0] == 'p' && memcmp(token, "pianifica-percorsi", 18) == 0) {
+            return CMD_PIANIFICA_PERCORSI;
+        }
+        break;
+    }
+    return CMD_SCONOSCIUTO;
+}
+
+// Legge comandi nel blocco finch c' spazio e l'input gi letto non finisce, come
+// i batch di main: chi manda un comando alla volta riceve subito la risposta
+void fill_command_block(InputReader* in, CommandBlock* block) {
+    block->count = 0;
+    block->autonomies_count = 0;
+    block->end = false;
+    block->input_error = false;
+
+    do {
+        const char* token;
+        size_t length;
+        if (!input_token(in, &token, &length)) {
+            block->end = true;
+            return;
+        }
+
+        ParsedCommand* command = &block->commands[block->count];
+        command->type = parse_command(token, length);
+        bool input_ok = true;
+        switch (command->type) {
+        case CMD_AGGIUNGI_STAZIONE:
+        case CMD_PIANIFICA_PERCORSI:
+            // Le autonomie, o gli arrivi, vanno nell'array comune del blocco
+            input_ok = input_int(in, &command->args[0]) && input_int(in, &command->args[1]);
+            if (input_ok) {
+                if (command->args[1] < 0) {
+                    command->args[1] = 0;
+                }
+                if (in->max_list > 0 && command->args[1] > in->max_list) {
+                    input_ok = false;
+                }
+                // Il buffer cresce con i valori letti davvero, non col numero dichiarato:
+                // una lista pi corta finisce in un errore di input
+                command->first_auto = block->autonomies_count;
+                for (int i = 0; i < command->args[1] && input_ok; i++) {
+                    size_t needed = (size_t)command->first_auto + (size_t)i + 1;
+                    block->autonomies = reserve_int_array(block->autonomies, &block->autonomies_capacity, needed, COMMAND_BLOCK_AUTOS);
+                    input_ok = input_int(in, &block->autonomies[command->first_auto + i]);
+                }
+                if (input_ok) {
+                    block->autonomies_count = command->first_auto + command->args[1];
+                }
+            }
+            break;
+        case CMD_DEMOLISCI_STAZIONE:
+            input_ok = input_int(in, &command->args[0]);
+            break;
+        case CMD_AGGIUNGI_AUTO:
+        case CMD_ROTTAMA_AUTO:
+        case CMD_PIANIFICA_PERCORSO:
+        case CMD_REGISTRA_PERCORSO:
+            input_ok = input_int(in, &command->args[0]) && input_int(in, &command->args[1]);
+            break;
+        case CMD_SCONOSCIUTO:
+            break;
+        }
+        if (!input_ok) {
+            block->input_error = true;
+            return;
+        }
+        block->count++;
+    } while (block->count < COMMAND_BLOCK_COMMANDS && block->autonomies_count < COMMAND_BLOCK_AUTOS && input_pending(in));
+}
+
+void init_spsc_ring(SpscRing* ring) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->sleeping, false);
+    pthread_mutex_init(&ring->mutex, NULL);
+    pthread_cond_init(&ring->ready, NULL);
+}
+
+void free_spsc_ring(SpscRing* ring) {
+    pthread_mutex_destroy(&ring->mutex);
+    pthread_cond_destroy(&ring->ready);
+}
+
+// Gli elementi in circolo sono al massimo SPSC_RING_SLOTS, quindi la coda non si
+// riempie mai
+void spsc_push(SpscRing* ring, void* item) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    ring->slots[tail % SPSC_RING_SLOTS] = item;
+    atomic_store(&ring->tail, tail + 1);
+
+    // tail e sleeping sono sequenzialmente consistenti: o il consumatore vede il
+    // nuovo elemento, o qui si vede che dorme
+    if (atomic_load(&ring->sleeping)) {
+        pthread_mutex_lock(&ring->mutex);
+        pthread_cond_signal(&ring->ready);
+        pthread_mutex_unlock(&ring->mutex);
+    }
+}
+
+bool spsc_empty(SpscRing* ring) {
+    return atomic_load_explicit(&ring->tail, memory_order_acquire) == atomic_load_explicit(&ring->head, memory_order_relaxed);
+}
+
+// Con wait falso restituisce NULL se la coda  vuota
+void* spsc_pop(SpscRing* ring, bool wait) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (atomic_load_explicit(&ring->tail, memory_order_acquire) == head) {
+        if (!wait) {
+            return NULL;
+        }
+        pthread_mutex_lock(&ring->mutex);
+        atomic_store(&ring->sleeping, true);
+        while (atomic_load(&ring->tail) == head) {
+            pthread_cond_wait(&ring->ready, &ring->mutex);
+        }
+        atomic_store(&ring->sleeping, false);
+        pthread_mutex_unlock(&ring->mutex);
+    }
+
+    void* item = ring->slots[head % SPSC_RING_SLOTS];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return item;
+}
+
+// Passa il contenuto di out allo stadio di scrittura e continua su un buffer vuoto
+void pipeline_send_output(Pipeline* pipeline, OutputBuffer* out) {
+    OutputBuffer* chunk = (OutputBuffer*)spsc_pop(&pipeline->free_chunks, true);
+    char* data = chunk->data;
+    size_t capacity = chunk->capacity;
+    chunk->data = out->data;
+    chunk->capacity = out->capacity;
+    chunk->length = out->length;
+    out->data = data;
+    out->capacity = capacity;
+    out->length = 0;
+    spsc_push(&pipeline->full_chunks, chunk);
+}
+
+void* pipeline_reader_main(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    for (;;) {
+        CommandBlock* block = (CommandBlock*)spsc_pop(&pipeline->free_blocks, true);
+        fill_command_block(pipeline->input, block);
+        bool last = block->end || block->input_error;
+        spsc_push(&pipeline->full_blocks, block);
+        if (last) {
+            return NULL;
+        }
+    }
+}
+
+void* pipeline_writer_main(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+
+#ifdef PLAN_ROUTE_STATS
+    // SIGUSR1 deve arrivare al thread principale o a quello che legge
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+#endif
+
+    OutputBuffer* chunk;
+    while ((chunk = (OutputBuffer*)spsc_pop(&pipeline->full_chunks, true)) != NULL) {
+        if (!write_all(pipeline->fd, chunk->data, chunk->length)) {
+            exit(1);
+        }
+        chunk->length = 0;
+        spsc_push(&pipeline->free_chunks, chunk);
+    }
+    return NULL;
+}
+
+CommandBlock* create_command_blocks(int count) {
+    CommandBlock* blocks = (CommandBlock*)calloc(count, sizeof(CommandBlock));
+    if (blocks == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    return blocks;
+}
+
+void free_command_blocks(CommandBlock* blocks, int count) {
+    for (int i = 0; i < count; i++) {
+        free(blocks[i].autonomies);
+    }
+    free(blocks);
+}
+
+// Memoria della pipeline, a stadi fermi
+void release_pipeline(Pipeline* pipeline) {
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        output_free(&pipeline->chunks[i]);
+    }
+    free_command_blocks(pipeline->blocks, PIPELINE_BLOCKS);
+    free_spsc_ring(&pipeline->full_blocks);
+    free_spsc_ring(&pipeline->free_blocks);
+    free_spsc_ring(&pipeline->full_chunks);
+    free_spsc_ring(&pipeline->free_chunks);
+}
+
+// Avvia gli stadi di lettura e scrittura; le risposte scritte su out passano da qui.
+// Restituisce false se i thread non partono, e si resta senza pipeline.
+bool init_pipeline(Pipeline* pipeline, InputReader* input, OutputBuffer* out, CommandSource* source) {
+    init_spsc_ring(&pipeline->full_blocks);
+    init_spsc_ring(&pipeline->free_blocks);
+    init_spsc_ring(&pipeline->full_chunks);
+    init_spsc_ring(&pipeline->free_chunks);
+    pipeline->blocks = create_command_blocks(PIPELINE_BLOCKS);
+    pipeline->input = input;
+    pipeline->fd = out->fd;
+
+    // Il primo blocco, vuoto,  dell'esecuzione
+    for (int i = 1; i < PIPELINE_BLOCKS; i++) {
+        spsc_push(&pipeline->free_blocks, &pipeline->blocks[i]);
+    }
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        output_init(&pipeline->chunks[i], -1);
+        spsc_push(&pipeline->free_chunks, &pipeline->chunks[i]);
+    }
+
+    // Legge solo lo stadio di lettura: le risposte escono quando l'esecuzione attende
+    OutputBuffer* flush_before_read = input->flush_before_read;
+    input->flush_before_read = NULL;
+
+    if (pthread_create(&pipeline->writer, NULL, pipeline_writer_main, pipeline) != 0) {
+        input->flush_before_read = flush_before_read;
+        release_pipeline(pipeline);
+        return false;
+    }
+    if (pthread_create(&pipeline->reader, NULL, pipeline_reader_main, pipeline) != 0) {
+        spsc_push(&pipeline->full_chunks, NULL);
+        pthread_join(pipeline->writer, NULL);
+        input->flush_before_read = flush_before_read;
+        release_pipeline(pipeline);
+        return false;
+    }
+
+    out->pipeline = pipeline;
+    free_command_blocks(source->block, 1);
+    source->pipeline = pipeline;
+    source->block = &pipeline->blocks[0];
+    source->pos = 0;
+    return true;
+}
+
+// Da chiamare dopo l'ultimo blocco: scrive le risposte rimaste e ferma gli stadi
+void free_pipeline(Pipeline* pipeline, OutputBuffer* out) {
+    output_flush(out);
+    out->pipeline = NULL;
+    spsc_push(&pipeline->full_chunks, NULL);
+    pthread_join(pipeline->writer, NULL);
+    pthread_join(pipeline->reader, NULL);
+    release_pipeline(pipeline);
+}
+
+void init_command_source(CommandSource* source, InputReader* input, OutputBuffer* out) {
+    source->input = input;
+    source->pipeline = NULL;
+    source->output = out;
+    source->block = create_command_blocks(1);
+    source->pos = 0;
+}
+
+void free_command_source(CommandSource* source) {
+    if (source->pipeline == NULL) {
+        free_command_blocks(source->block, 1);
+    }
+}
+
+// Prossimo comando, senza consumarlo. Restituisce NULL alla fine dell'input, dopo
+// un comando incompleto o, con wait falso, se il comando non  ancora stato letto.
+// Il comando e le sue autonomie restano validi fino alla chiamata successiva.
+ParsedCommand* command_peek(CommandSource* source, bool wait) {
+    while (source->pos == source->block->count) {
+        if (source->block->end || source->block->input_error) {
+            return NULL;
+        }
+        if (source->pipeline == NULL) {
+            if (!wait && !input_pending(source->input)) {
+                return NULL;
+            }
+            fill_command_block(source->input, source->block);
+        } else {
+            Pipeline* pipeline = source->pipeline;
+            if (spsc_empty(&pipeline->full_blocks)) {
+                if (!wait) {
+                    return NULL;
                 }
+                // Chi manda un comando alla volta deve ricevere le risposte
+                output_flush(source->output);
             }
+            CommandBlock* next = (CommandBlock*)spsc_pop(&pipeline->full_blocks, true);
+            spsc_push(&pipeline->free_blocks, source->block);
+            source->block = next;
+        }
+        source->pos = 0;
+    }
+    return &source->block->commands[source->pos];
+}
 
-            int is_added;
-            root = add_car(root, distanza, numero_auto, autonomie, &is_added);
+int* command_autonomies(CommandSource* source, ParsedCommand* command) {
+    return source->block->autonomies + command->first_auto;
+}
+
+VersionChunk* create_version_chunk(void) {
+    VersionChunk* chunk = (VersionChunk*)malloc(sizeof(VersionChunk));
+    if (chunk == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    chunk->refs = 1;
+    chunk->count = 0;
+    return chunk;
+}
+
+void release_version_chunk(VersionChunk* chunk) {
+    if (--chunk->refs == 0) {
+        free(chunk);
+    }
+}
+
+NetworkVersion* create_network_version(int capacity) {
+    NetworkVersion* version = (NetworkVersion*)malloc(sizeof(NetworkVersion));
+    if (version == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    version->capacity = capacity > 0 ? capacity : 1;
+    version->chunks = (VersionChunk**)malloc(version->capacity * sizeof(VersionChunk*));
+    version->first = (int32_t*)malloc(version->capacity * sizeof(int32_t));
+    if (version->chunks == NULL || version->first == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    version->version = 0;
+    version->count = 0;
+    version->num_chunks = 0;
+    version->next = NULL;
+    return version;
+}
+
+void free_network_version(NetworkVersion* version) {
+    for (int c = 0; c < version->num_chunks; c++) {
+        release_version_chunk(version->chunks[c]);
+    }
+    free(version->chunks);
+    free(version->first);
+    free(version);
+}
+
+// Inserisce un blocco vuoto in posizione c della tabella e lo restituisce
+VersionChunk* network_version_insert_chunk(NetworkVersion* version, int c) {
+    if (version->num_chunks == version->capacity) {
+        version->capacity *= 2;
+        version->chunks = (VersionChunk**)realloc(version->chunks, version->capacity * sizeof(VersionChunk*));
+        version->first = (int32_t*)realloc(version->first, version->capacity * sizeof(int32_t));
+        if (version->chunks == NULL || version->first == NULL) {
+            printf("Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    memmove(version->chunks + c + 1, version->chunks + c, (version->num_chunks - c) * sizeof(VersionChunk*));
+    memmove(version->first + c + 1, version->first + c, (version->num_chunks - c) * sizeof(int32_t));
+    version->chunks[c] = create_version_chunk();
+    version->num_chunks++;
+    return version->chunks[c];
+}
+
+// Rende modificabile il blocco c, copiandolo se lo usano anche altre versioni
+VersionChunk* network_version_own_chunk(NetworkVersion* version, int c) {
+    VersionChunk* chunk = version->chunks[c];
+    if (chunk->refs == 1) {
+        return chunk;
+    }
+    VersionChunk* copy = create_version_chunk();
+    copy->count = chunk->count;
+    memcpy(copy->distance, chunk->distance, chunk->count * sizeof(int32_t));
+    memcpy(copy->max_reach, chunk->max_reach, chunk->count * sizeof(int32_t));
+    chunk->refs--;
+    version->chunks[c] = copy;
+    return copy;
+}
+
+// Versione costruita da zero scorrendo l'indice, con i blocchi pieni
+NetworkVersion* build_network_version(StationIndex* index) {
+    NetworkVersion* version = create_network_version((index->size + VERSION_CHUNK_STATIONS - 1) / VERSION_CHUNK_STATIONS);
+    VersionChunk* chunk = NULL;
+    Station* station;
+    for (StationCursor it = station_first(index); (station = station_cursor_get(&it)) != NULL; station_cursor_next(&it)) {
+        if (chunk == NULL || chunk->count == VERSION_CHUNK_STATIONS) {
+            chunk = network_version_insert_chunk(version, version->num_chunks);
+            version->first[version->num_chunks - 1] = station->distance;
+        }
+        chunk->distance[chunk->count] = station->distance;
+        chunk->max_reach[chunk->count] = station_max_reach(station);
+        chunk->count++;
+    }
+    version->count = index->size;
+    version->version = index->route_version;
+    return version;
+}
+
+// Versione successiva a old: condivide i blocchi di old e copia solo quelli delle
+// stazioni cambiate dopo old->version, come station_array_refresh ma senza spostare
+// tutte le stazioni dopo un inserimento. Il costo  la tabella dei blocchi pi un
+// blocco per modifica, invece di tutta la rete.
+NetworkVersion* derive_network_version(NetworkVersion* old, StationIndex* index) {
+    NetworkVersion* version = create_network_version(old->num_chunks + 1);
+    memcpy(version->chunks, old->chunks, old->num_chunks * sizeof(VersionChunk*));
+    memcpy(version->first, old->first, old->num_chunks * sizeof(int32_t));
+    version->num_chunks = old->num_chunks;
+    version->count = old->count;
+    for (int c = 0; c < version->num_chunks; c++) {
+        version->chunks[c]->refs++;
+    }
 
-            if (is_added) {
-                printf("aggiunta\n");
+    for (unsigned long long v = old->version + 1; v <= index->route_version; v++) {
+        int distance = index->route_changes[v % ROUTE_CHANGE_LOG_SIZE].distance;
+        int c = network_version_find_chunk(version, distance);
+        VersionChunk* chunk = version->num_chunks > 0 ? version->chunks[c] : NULL;
+        int pos = chunk != NULL ? version_chunk_lower_bound(chunk, distance) : 0;
+        bool present = chunk != NULL && pos < chunk->count && chunk->distance[pos] == distance;
+        Station* station = search_station(index, distance);
+
+        if (station == NULL) {
+            if (!present) {
+                continue;
+            }
+            chunk = network_version_own_chunk(version, c);
+            memmove(chunk->distance + pos, chunk->distance + pos + 1, (chunk->count - pos - 1) * sizeof(int32_t));
+            memmove(chunk->max_reach + pos, chunk->max_reach + pos + 1, (chunk->count - pos - 1) * sizeof(int32_t));
+            chunk->count--;
+            version->count--;
+            if (chunk->count == 0) {
+                release_version_chunk(chunk);
+                memmove(version->chunks + c, version->chunks + c + 1, (version->num_chunks - c - 1) * sizeof(VersionChunk*));
+                memmove(version->first + c, version->first + c + 1, (version->num_chunks - c - 1) * sizeof(int32_t));
+                version->num_chunks--;
             } else {
-                printf("non aggiunta\n");
+                version->first[c] = chunk->distance[0];
             }
-        } else if (strcmp(comando, "demolisci-stazione") == 0) {
-            int distanza;
+            continue;
+        }
 
-            if (scanf("%d", &distanza) != 1) {
-                printf("Errore di input\n");
-                break;
+        int32_t reach = station_max_reach(station);
+        if (present) {
+            // Le auto che non cambiano l'autonomia massima non toccano il blocco
+            if (chunk->max_reach[pos] != reach) {
+                network_version_own_chunk(version, c)->max_reach[pos] = reach;
             }
+            continue;
+        }
 
-            int is_removed;
-            root = delete_station(root, distanza, &is_removed);
+        if (chunk == NULL) {
+            network_version_insert_chunk(version, 0);
+        } else if (chunk->count == VERSION_CHUNK_STATIONS) {
+            // Un blocco pieno si divide a met
+            int half = VERSION_CHUNK_STATIONS / 2;
+            chunk = network_version_own_chunk(version, c);
+            VersionChunk* right = network_version_insert_chunk(version, c + 1);
+            right->count = chunk->count - half;
+            memcpy(right->distance, chunk->distance + half, right->count * sizeof(int32_t));
+            memcpy(right->max_reach, chunk->max_reach + half, right->count * sizeof(int32_t));
+            chunk->count = half;
+            version->first[c + 1] = right->distance[0];
+            if (pos > half) {
+                c++;
+                pos -= half;
+            }
+        }
+        chunk = network_version_own_chunk(version, c);
+        memmove(chunk->distance + pos + 1, chunk->distance + pos, (chunk->count - pos) * sizeof(int32_t));
+        memmove(chunk->max_reach + pos + 1, chunk->max_reach + pos, (chunk->count - pos) * sizeof(int32_t));
+        chunk->distance[pos] = distance;
+        chunk->max_reach[pos] = reach;
+        chunk->count++;
+        version->count++;
+        version->first[c] = chunk->distance[0];
+    }
 
-            if (is_removed) {
-                printf("demolita\n");
-            } else {
-                printf("non demolita\n");
+    version->version = index->route_version;
+    return version;
+}
+
+// Pubblica la rete attuale, se  cambiata, e libera le versioni ritirate che nessun
+// lettore annuncia pi. Solo lo scrittore pubblica.
+void server_publish(Server* server) {
+    StationIndex* index = server->index;
+    NetworkVersion* old = atomic_load(&server->current);
+    if (old != NULL && old->version == index->route_version) {
+        return;
+    }
+    // Si riparte dall'indice quando il registro delle modifiche non basta pi o
+    // quando le demolizioni hanno lasciato troppi blocchi semivuoti
+    if (old == NULL || index->route_version - old->version > ROUTE_CHANGE_LOG_SIZE ||
+        old->num_chunks > 2 * (old->count / VERSION_CHUNK_STATIONS) + 8) {
+        atomic_store(&server->current, build_network_version(index));
+    } else {
+        atomic_store(&server->current, derive_network_version(old, index));
+    }
+    if (old == NULL) {
+        return;
+    }
+    old->next = server->retired;
+    server->retired = old;
+
+    // Un lettore che annuncia una versione dopo questo punto la ricontrolla e trova
+    // quella nuova, quindi basta guardare gli slot adesso
+    NetworkVersion** link = &server->retired;
+    while (*link != NULL) {
+        NetworkVersion* version = *link;
+        bool in_use = false;
+        for (int slot = 0; slot < SERVER_MAX_CLIENTS && !in_use; slot++) {
+            in_use = atomic_load(&server->hazards[slot]) == version;
+        }
+        if (in_use) {
+            link = &version->next;
+        } else {
+            *link = version->next;
+            free_network_version(version);
+        }
+    }
+}
+
+// Annuncia nello slot la versione pi recente e la restituisce: resta valida fino
+// a server_release
+NetworkVersion* server_acquire(Server* server, int slot) {
+    NetworkVersion* version = atomic_load(&server->current);
+    for (;;) {
+        atomic_store(&server->hazards[slot], version);
+        NetworkVersion* current = atomic_load(&server->current);
+        if (current == version) {
+            return version;
+        }
+        version = current;
+    }
+}
+
+void server_release(Server* server, int slot) {
+    atomic_store_explicit(&server->hazards[slot], NULL, memory_order_release);
+}
+
+// Esegue le modifiche di un client sul log, che si applica prima della pubblicazione
+void server_apply(Server* server, MutationRequest* request) {
+    for (int i = 0; i < request->count; i++) {
+        ParsedCommand* cmd = &request->commands[i];
+        mutation_log_execute(&server->log, &request->responses, server->index, cmd, request->autonomies + cmd->first_auto);
+    }
+}
+
+void* server_writer_main(void* arg) {
+    Server* server = (Server*)arg;
+
+    pthread_mutex_lock(&server->mutex);
+    for (;;) {
+        while (server->queue_head == NULL && !server->stopping) {
+            pthread_cond_wait(&server->queue_ready, &server->mutex);
+        }
+        MutationRequest* requests = server->queue_head;
+        if (requests == NULL) {
+            break;
+        }
+        server->queue_head = NULL;
+        server->queue_tail = NULL;
+        pthread_mutex_unlock(&server->mutex);
+
+        // Le richieste arrivate insieme escono in un'unica versione
+        for (MutationRequest* request = requests; request != NULL; request = request->next) {
+            STATS_TIMER_START(timer);
+            server_apply(server, request);
+            for (int i = 0; i < request->count; i++) {
+                STATS_TIMER_STOP(timer, request->commands[i].type);
             }
-        } else if (strcmp(comando, "aggiungi-auto") == 0) {
-            int distanza, autonomia;
+        }
+        mutation_log_apply(&server->log, server->index);
+        server_publish(server);
 
-            if (scanf("%d %d", &distanza, &autonomia) != 2) {
-                printf("Errore di input\n");
-                break;
+        while (requests != NULL) {
+            // Dopo done il client pu riusare la richiesta
+            MutationRequest* next = requests->next;
+            pthread_mutex_lock(&requests->mutex);
+            requests->done = true;
+            pthread_cond_signal(&requests->done_cond);
+            pthread_mutex_unlock(&requests->mutex);
+            requests = next;
+        }
+        pthread_mutex_lock(&server->mutex);
+    }
+    pthread_mutex_unlock(&server->mutex);
+    return NULL;
+}
+
+// Manda le modifiche allo scrittore e attende che la versione che le contiene sia
+// pubblicata: le query successive dello stesso client le vedono
+void server_submit(Server* server, MutationRequest* request) {
+    request->done = false;
+    request->next = NULL;
+    request->responses.length = 0;
+
+    pthread_mutex_lock(&server->mutex);
+    if (server->queue_tail != NULL) {
+        server->queue_tail->next = request;
+    } else {
+        server->queue_head = request;
+    }
+    server->queue_tail = request;
+    pthread_cond_signal(&server->queue_ready);
+    pthread_mutex_unlock(&server->mutex);
+
+    pthread_mutex_lock(&request->mutex);
+    while (!request->done) {
+        pthread_cond_wait(&request->done_cond, &request->mutex);
+    }
+    pthread_mutex_unlock(&request->mutex);
+}
+
+// Una connessione: legge i comandi come main, risponde ai pianifica-percorso sulla
+// versione pi recente e passa le modifiche allo scrittore
+void* server_client_main(void* arg) {
+    ServerClient* client = (ServerClient*)arg;
+    Server* server = client->server;
+    MutationRequest* request = &client->request;
+    InputReader input;
+    OutputBuffer output;
+    CommandSource source;
+    RouteWorkspace ws;
+
+    memset(&ws, 0, sizeof(RouteWorkspace));
+    output_init(&request->responses, -1);
+    pthread_mutex_init(&request->mutex, NULL);
+    pthread_cond_init(&request->done_cond, NULL);
+    input_open_fd(&input, client->fd);
+    input.max_list = SERVER_MAX_COMMAND_AUTOS;
+    output_init(&output, client->fd);
+    input.flush_before_read = &output;
+    init_command_source(&source, &input, &output);
+
+    ParsedCommand* cmd;
+    while (!output.closed && (cmd = command_peek(&source, true)) != NULL) {
+        if (cmd->type == CMD_PIANIFICA_PERCORSO) {
+            STATS_TIMER_START(timer);
+            NetworkVersion* version = server_acquire(server, client->slot);
+            pianifica_percorso_versione(&output, version, &ws, cmd->args[1], cmd->args[0]);
+            server_release(server, client->slot);
+            source.pos++;
+            STATS_TIMER_STOP(timer, CMD_PIANIFICA_PERCORSO);
+        } else if (cmd->type == CMD_PIANIFICA_PERCORSI) {
+            STATS_TIMER_START(timer);
+            NetworkVersion* version = server_acquire(server, client->slot);
+            pianifica_percorsi_versione(&output, version, &ws, cmd->args[0], command_autonomies(&source, cmd), cmd->args[1]);
+            server_release(server, client->slot);
+            source.pos++;
+            STATS_TIMER_STOP(timer, CMD_PIANIFICA_PERCORSI);
+        } else if (command_is_mutation(cmd->type)) {
+            // Le modifiche consecutive gi lette vanno allo scrittore insieme
+            request->commands = cmd;
+            request->autonomies = source.block->autonomies;
+            request->count = 0;
+            while (source.pos < source.block->count && command_is_mutation(source.block->commands[source.pos].type)) {
+                source.pos++;
+                request->count++;
             }
+            server_submit(server, request);
+            output_bytes(&output, request->responses.data, request->responses.length);
+        } else if (cmd->type == CMD_REGISTRA_PERCORSO) {
+            // I percorsi registrati vengono riparati dal ciclo di main, che qui non c':
+            // la risposta  diversa da quella di un percorso gi registrato
+            output_string(&output, "non supportato\n");
+            source.pos++;
+        } else {
+            source.pos++;
+        }
+    }
+    if (source.block->input_error) {
+        output_string(&output, "Errore di input\n");
+    }
 
-            int is_added;
-            insert_auto(root, distanza, autonomia, &is_added);
+    free_command_source(&source);
+    output_free(&output);
+    pthread_mutex_lock(&server->mutex);
+    server->client_fds[client->slot] = -1;
+    pthread_mutex_unlock(&server->mutex);
+    input_close(&input);
+    free_route_workspace(&ws);
+    output_free(&request->responses);
+    pthread_mutex_destroy(&request->mutex);
+    pthread_cond_destroy(&request->done_cond);
 
-            if (is_added) {
-                printf("aggiunta\n");
-            } else {
-                printf("non aggiunta\n");
+    pthread_mutex_lock(&server->mutex);
+    server->active_clients--;
+    pthread_cond_signal(&server->clients_done);
+    pthread_mutex_unlock(&server->mutex);
+    free(client);
+    return NULL;
+}
+
+volatile sig_atomic_t server_stop_requested = 0;
+
+void server_signal_handler(int signal) {
+    (void)signal;
+    server_stop_requested = 1;
+}
+
+// Avvia un thread con SIGINT e SIGTERM bloccati, che devono interrompere accept
+bool server_start_thread(pthread_t* thread, void* (*start)(void*), void* arg) {
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+#ifdef PLAN_ROUTE_STATS
+    sigaddset(&signals, SIGUSR1);
+#endif
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    bool started = pthread_create(thread, NULL, start, arg) == 0;
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    return started;
+}
+
+// Modalit server: accetta connessioni sul socket Unix path finch non arriva
+// SIGINT o SIGTERM. Ogni connessione parla il linguaggio dei comandi di stdin con un
+// suo thread; le modifiche passano da un solo scrittore, che le applica all'indice
+// e pubblica una versione immutabile della vista struct-of-arrays a blocchi
+// condivisi con quella precedente, mentre i pianifica-percorso leggono l'ultima
+// versione pubblicata senza lock, con un motore che lavora sulla vista (main rifiuta
+// gli altri e --verify-engine). registra-percorso risponde "non supportato". All'uscita
+// l'indice contiene la rete lasciata dai client.
+bool run_server(StationIndex* index, const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Percorso del socket troppo lungo: %s\n", path);
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    // Un socket rimasto da un server precedente si pu sostituire, un file no
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "Impossibile ascoltare su %s\n", path);
+        if (listen_fd >= 0) {
+            close(listen_fd);
+        }
+        return false;
+    }
+
+    Server* server = (Server*)calloc(1, sizeof(Server));
+    if (server == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+    server->index = index;
+    atomic_init(&server->current, NULL);
+    for (int slot = 0; slot < SERVER_MAX_CLIENTS; slot++) {
+        atomic_init(&server->hazards[slot], NULL);
+        server->client_fds[slot] = -1;
+    }
+    pthread_mutex_init(&server->mutex, NULL);
+    pthread_cond_init(&server->queue_ready, NULL);
+    pthread_cond_init(&server->clients_done, NULL);
+
+    server_publish(server);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, NULL);
+    // Senza SA_RESTART: il segnale interrompe accept
+    action.sa_handler = server_signal_handler;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pthread_t writer;
+    if (!server_start_thread(&writer, server_writer_main, server)) {
+        fprintf(stderr, "Impossibile avviare lo scrittore del server\n");
+        exit(1);
+    }
+
+    while (!server_stop_requested) {
+        STATS_POLL();
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) {
+                continue;
             }
-        } else if (strcmp(comando, "rottama-auto") == 0) {
-            int distanza, autonomia;
+            break;
+        }
 
-            if (scanf("%d %d", &distanza, &autonomia) != 2) {
-                printf("Errore di input\n");
+        ServerClient* client = NULL;
+        pthread_mutex_lock(&server->mutex);
+        for (int slot = 0; slot < SERVER_MAX_CLIENTS; slot++) {
+            if (server->client_fds[slot] == -1) {
+                client = (ServerClient*)malloc(sizeof(ServerClient));
+                if (client == NULL) {
+                    printf("Memory allocation failed\n");
+                    exit(1);
+                }
+                client->server = server;
+                client->fd = fd;
+                client->slot = slot;
+                server->client_fds[slot] = fd;
+                server->active_clients++;
                 break;
             }
+        }
+        pthread_mutex_unlock(&server->mutex);
+        // Con tutti gli slot occupati la connessione si chiude subito
+        if (client == NULL) {
+            close(fd);
+            continue;
+        }
 
-            int is_removed;
-            remove_auto(root, distanza, autonomia, &is_removed);
+        pthread_t thread;
+        if (!server_start_thread(&thread, server_client_main, client)) {
+            pthread_mutex_lock(&server->mutex);
+            server->client_fds[client->slot] = -1;
+            server->active_clients--;
+            pthread_mutex_unlock(&server->mutex);
+            close(fd);
+            free(client);
+            continue;
+        }
+        pthread_detach(thread);
+    }
 
-            if(is_removed) {
-                printf("rottamata\n");
-            } else {
-                printf("non rottamata\n");
+    close(listen_fd);
+    unlink(path);
+
+    // Le connessioni aperte vedono la fine dell'input; le modifiche gi inviate
+    // vengono applicate prima di fermare lo scrittore
+    pthread_mutex_lock(&server->mutex);
+    for (int slot = 0; slot < SERVER_MAX_CLIENTS; slot++) {
+        if (server->client_fds[slot] != -1) {
+            shutdown(server->client_fds[slot], SHUT_RDWR);
+        }
+    }
+    while (server->active_clients > 0) {
+        pthread_cond_wait(&server->clients_done, &server->mutex);
+    }
+    server->stopping = true;
+    pthread_cond_signal(&server->queue_ready);
+    pthread_mutex_unlock(&server->mutex);
+    pthread_join(writer, NULL);
+
+    free_network_version(atomic_load(&server->current));
+    while (server->retired != NULL) {
+        NetworkVersion* next = server->retired->next;
+        free_network_version(server->retired);
+        server->retired = next;
+    }
+    free_mutation_log(&server->log);
+    pthread_mutex_destroy(&server->mutex);
+    pthread_cond_destroy(&server->queue_ready);
+    pthread_cond_destroy(&server->clients_done);
+    free(server);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    StationIndex index;
+    InputReader input;
+    OutputBuffer output;
+    RouteCache route_cache;
+    QueryPool pool;
+    RouteSubscriptions subscriptions;
+    Pipeline pipeline;
+    bool use_pipeline = false;
+    bool use_route_cache = true;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char* input_path = NULL;
+    const char* stats_path = NULL;
+    const char* load_snapshot_path = NULL;
+    const char* save_snapshot_path = NULL;
+    const char* simd_level = NULL;
+    const char* server_path = NULL;
+    const char* engine_name = NULL;
+    const char* verify_name = NULL;
+    bool use_dijkstra = false, use_jump = false, use_soa = false, use_bidirectional = false;
+    MutationLog mutation_log;
+
+    init_station_index(&index);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            engine_name = argv[++i];
+        } else if (strcmp(argv[i], "--verify-engine") == 0 && i + 1 < argc) {
+            verify_name = argv[++i];
+        } else if (strcmp(argv[i], "--dijkstra") == 0) {
+            use_dijkstra = true;
+        } else if (strcmp(argv[i], "--jump-index") == 0) {
+            use_jump = true;
+        } else if (strcmp(argv[i], "--soa") == 0) {
+            use_soa = true;
+        } else if (strcmp(argv[i], "--bidirectional") == 0) {
+            use_bidirectional = true;
+        } else if (strcmp(argv[i], "--simd") == 0 && i + 1 < argc) {
+            simd_level = argv[++i];
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            // --server socket: gli stessi comandi di stdin su un socket Unix, tranne
+            // registra-percorso, a cui il server risponde "non supportato"
+            server_path = argv[++i];
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            use_pipeline = true;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            use_route_cache = false;
+        } else if (strcmp(argv[i], "--load-snapshot") == 0 && i + 1 < argc) {
+            load_snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+            save_snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            // Senza file, o seguito da un'altra opzione, scrive su stderr
+            stats_path = i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0 ? argv[++i] : "-";
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = strtol(argv[++i], NULL, 10);
+        } else {
+            input_path = argv[i];
+        }
+    }
+
+    select_simd_kernels(simd_level);
+
+    // Senza --engine valgono i flag dei singoli motori, con --dijkstra davanti a tutti.
+    // I lettori del server hanno solo la vista: senza una scelta esplicita usano soa.
+    if (engine_name == NULL) {
+        engine_name = use_dijkstra ? "dijkstra" : use_jump ? "jump" : use_bidirectional ? "bidirectional" : use_soa ? "soa" :
+                      server_path != NULL ? "soa" : "sweep";
+    }
+    planner_engine = find_planner_engine(engine_name);
+    if (planner_engine == NULL) {
+        fprintf(stderr, "Motore sconosciuto: %s\n", engine_name);
+        exit(1);
+    }
+    if (verify_name != NULL) {
+        verify_engine = find_planner_engine(verify_name);
+        if (verify_engine == NULL) {
+            fprintf(stderr, "Motore sconosciuto: %s\n", verify_name);
+            exit(1);
+        }
+        // Una risposta dalla cache salterebbe il confronto
+        use_route_cache = false;
+    }
+    if (server_path != NULL && planner_engine->plan_array == NULL) {
+        fprintf(stderr, "Motore %s non disponibile con --server: i lettori usano solo la vista (soa, bidirectional)\n",
+                planner_engine->name);
+        exit(1);
+    }
+    if (server_path != NULL && verify_engine != NULL) {
+        fprintf(stderr, "--verify-engine non  disponibile con --server\n");
+        exit(1);
+    }
+    index.jump.enabled = planner_engine->needs_jump || (verify_engine != NULL && verify_engine->needs_jump);
+    index.array.enabled = planner_engine->needs_array || (verify_engine != NULL && verify_engine->needs_array);
+
+#ifdef PLAN_ROUTE_STATS
+    stats_init(stats_path);
+#else
+    if (stats_path != NULL) {
+        fprintf(stderr, "--stats ignorato: strumentazione non compilata (serve -DPLAN_ROUTE_STATS)\n");
+    }
+#endif
+
+    if (load_snapshot_path != NULL && !load_snapshot(&index, load_snapshot_path)) {
+        fprintf(stderr, "Snapshot non valido: %s\n", load_snapshot_path);
+        exit(1);
+    }
+
+    // Il server prende il posto del ciclo dei comandi: la rete iniziale arriva da
+    // uno snapshot o dai client
+    if (server_path != NULL) {
+        if (!run_server(&index, server_path)) {
+            exit(1);
+        }
+#ifdef PLAN_ROUTE_STATS
+        stats_dump();
+#endif
+        if (save_snapshot_path != NULL && !save_snapshot(&index, save_snapshot_path)) {
+            fprintf(stderr, "Impossibile salvare lo snapshot %s\n", save_snapshot_path);
+        }
+        free_station_index(&index);
+        return 0;
+    }
+
+    input_open(&input, input_path);
+    output_init(&output, STDOUT_FILENO);
+    input.flush_before_read = &output;
+    if (use_route_cache) {
+        init_route_cache(&route_cache, ROUTE_CACHE_CAPACITY, ROUTE_CACHE_MAX_BYTES);
+    }
+    if (num_threads > 64) {
+        num_threads = 64;
+    }
+    init_query_pool(&pool, (int)num_threads);
+    init_route_subscriptions(&subscriptions);
+    memset(&mutation_log, 0, sizeof(MutationLog));
+
+    RouteQuery* batch = (RouteQuery*)malloc(QUERY_BATCH_MAX * sizeof(RouteQuery));
+    if (batch == NULL) {
+        printf("Memory allocation failed\n");
+        exit(1);
+    }
+
+    CommandSource source;
+    init_command_source(&source, &input, &output);
+    if (use_pipeline && !init_pipeline(&pipeline, &input, &output, &source)) {
+        use_pipeline = false;
+    }
+
+    ParsedCommand* cmd;
+    while ((cmd = command_peek(&source, true)) != NULL) {
+        CommandType command = cmd->type;
+        source.pos++;
+        STATS_TIMER_START(timer);
+
+        if (command_is_mutation(command)) {
+            mutation_log_execute(&mutation_log, &output, &index, cmd, command_autonomies(&source, cmd));
+        } else if (mutation_log.count > 0) {
+            // Gli altri comandi leggono l'indice: il log si applica prima, insieme
+            // alla riparazione dei percorsi registrati che le modifiche toccano
+            mutation_log_apply(&mutation_log, &index);
+            update_route_subscriptions(&subscriptions, &index);
+        }
+
+        if (command == CMD_PIANIFICA_PERCORSO) {
+            // I pianifica-percorso consecutivi formano un batch: fino al prossimo
+            // comando di modifica l'indice non cambia. Il batch si chiude quando
+            // finiscono i comandi gi letti, per non attendere altri comandi.
+            int count = 0;
+            for (;;) {
+                batch[count].partenza = cmd->args[0];
+                batch[count].arrivo = cmd->args[1];
+                count++;
+                if (count == QUERY_BATCH_MAX) {
+                    break;
+                }
+                cmd = command_peek(&source, false);
+                if (cmd == NULL || cmd->type != CMD_PIANIFICA_PERCORSO) {
+                    break;
+                }
+                source.pos++;
             }
-        } else if (strcmp(comando, "pianifica-percorso") == 0) {
-            int partenza, arrivo;
 
-            if (scanf("%d %d", &partenza, &arrivo) != 2) {
-                printf("Errore di input\n");
-                break;
+            execute_query_batch(&pool, &subscriptions, use_route_cache ? &route_cache : NULL, &output, &index, batch, count);
+        } else if (command == CMD_REGISTRA_PERCORSO) {
+            if (register_route(&subscriptions, &index, cmd->args[0], cmd->args[1])) {
+                output_string(&output, "registrato\n");
+            } else {
+                output_string(&output, "non registrato\n");
             }
+        } else if (command == CMD_PIANIFICA_PERCORSI) {
+            if (planner_engine->one_to_many && verify_engine == NULL) {
+                pianifica_percorsi(&output, &index, &pool.workers[0].workspace, cmd->args[0], command_autonomies(&source, cmd), cmd->args[1]);
+            } else {
+                pianifica_percorsi_espansi(&pool, &subscriptions, use_route_cache ? &route_cache : NULL, &output, &index, batch,
+                                           cmd->args[0], command_autonomies(&source, cmd), cmd->args[1]);
+            }
+        }
+
+        // I percorsi registrati vengono riparati appena una modifica arriva all'indice
+        update_route_subscriptions(&subscriptions, &index);
 
-            pianifica_percorso(root, arrivo, partenza);
+        // I comandi dei batch vengono misurati uno per uno dove si eseguono
+        if (command != CMD_PIANIFICA_PERCORSO) {
+            STATS_TIMER_STOP(timer, command);
         }
+        STATS_POLL();
+    }
+    // Il comando incompleto ferma l'esecuzione dopo quelli che lo precedono
+    if (source.block->input_error) {
+        output_string(&output, "Errore di input\n");
+    }
+    if (use_pipeline) {
+        free_pipeline(&pipeline, &output);
+    }
+    free_command_source(&source);
+
+#ifdef PLAN_ROUTE_STATS
+    stats_dump();
+#endif
+    if (verify_engine != NULL) {
+        stampa_tempi_verifica();
     }
 
-    free_bst(root);
+    // Lo snapshot contiene la rete come la lasciano i comandi letti
+    mutation_log_apply(&mutation_log, &index);
+    if (save_snapshot_path != NULL && !save_snapshot(&index, save_snapshot_path)) {
+        fprintf(stderr, "Impossibile salvare lo snapshot %s\n", save_snapshot_path);
+    }
+
+    if (use_route_cache) {
+        free_route_cache(&route_cache);
+    }
+    output_free(&output);
+    input_close(&input);
+    free_mutation_log(&mutation_log);
+    free(batch);
+    free_route_subscriptions(&subscriptions);
+    free_query_pool(&pool);
+    free_station_index(&index);
 
     return 0;
 }
-